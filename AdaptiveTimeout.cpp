@@ -0,0 +1,184 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "AdaptiveTimeout.h"
+#include "Timing.h"
+#include <cmath>
+
+using namespace std;
+using namespace KClmtrBase::KClmtrNative;
+
+AdaptiveTimeout::AdaptiveTimeout() {
+    m_factor = 0;
+    m_minimumMargin = 20000;
+    m_commandLength = 0;
+    m_expected = 0;
+    m_speed = 0;
+    m_sent = 0;
+    m_lastTimeout = 0;
+#ifdef WIN32
+    InitializeCriticalSection(&m_lock);
+#else
+    pthread_mutex_init(&m_lock, NULL);
+#endif
+}
+AdaptiveTimeout::~AdaptiveTimeout() {
+#ifdef WIN32
+    DeleteCriticalSection(&m_lock);
+#else
+    pthread_mutex_destroy(&m_lock);
+#endif
+}
+void AdaptiveTimeout::lock() const {
+#ifdef WIN32
+    EnterCriticalSection(&m_lock);
+#else
+    pthread_mutex_lock(&m_lock);
+#endif
+}
+void AdaptiveTimeout::unlock() const {
+#ifdef WIN32
+    LeaveCriticalSection(&m_lock);
+#else
+    pthread_mutex_unlock(&m_lock);
+#endif
+}
+void AdaptiveTimeout::setSafetyFactor(double factor) {
+    lock();
+    m_factor = factor < 0 ? 0 : factor;
+    unlock();
+}
+double AdaptiveTimeout::getSafetyFactor() const {
+    lock();
+    double factor = m_factor;
+    unlock();
+    return factor;
+}
+void AdaptiveTimeout::setMinimumMargin(long long margin_us) {
+    lock();
+    m_minimumMargin = margin_us < 0 ? 0 : margin_us;
+    unlock();
+}
+string AdaptiveTimeout::key(const string &commandString) {
+    //The cal file and password messages change every time, the command is the first two
+    return commandString.substr(0, 2);
+}
+void AdaptiveTimeout::begin(const string &commandString, int expected, int speed) {
+    string command = key(commandString);
+    lock();
+    m_command = command;
+    m_commandLength = (int)commandString.size() + 1;
+    m_expected = expected > 0 ? expected : 0;
+    m_speed = speed;
+    m_sent = monotonicMicroseconds();
+    unlock();
+}
+long long AdaptiveTimeout::wireTime() const {
+    if(m_speed <= 0) {
+        return 0;
+    }
+    //8n1 is 10 bits a byte, both ways
+    return (long long)(m_commandLength + m_expected) * 10 * 1000000LL / m_speed;
+}
+long long AdaptiveTimeout::deadline(long timeOut_Sec) {
+    //1.5 is added to make sure there isn't a range change
+    //interrupting our commucation.
+    long long timeOut = timeOut_Sec * 1500000LL;
+    lock();
+    if(m_factor > 0 && !m_command.empty()) {
+        map<string, timing>::const_iterator t = m_timings.find(m_command);
+        if(t != m_timings.end() && t->second.samples >= minimumSamples) {
+            long long margin = (long long)(m_factor * (t->second.average + 4 * t->second.deviation));
+            if(margin < m_minimumMargin) {
+                margin = m_minimumMargin;
+            }
+            long long adaptive = wireTime() + margin;
+            if(adaptive < timeOut) {
+                timeOut = adaptive;
+            }
+        }
+    }
+    m_lastTimeout = timeOut;
+    long long sent = m_sent;
+    unlock();
+    return sent + timeOut;
+}
+void AdaptiveTimeout::finish() {
+    long long now = monotonicMicroseconds();
+    lock();
+    if(m_command.empty()) {
+        unlock();
+        return;
+    }
+    double roundTrip = (double)(now - m_sent);
+    double sample = roundTrip - wireTime();
+    if(sample < 0) {
+        sample = 0;
+    }
+    timing &t = m_timings[m_command];
+    if(t.samples == 0) {
+        t.average = sample;
+        t.deviation = sample / 2;
+        t.roundTrip = roundTrip;
+    } else {
+        t.roundTrip += (roundTrip - t.roundTrip) / 8;
+        //Same weights as TCP, RFC 6298
+        t.deviation += (fabs(sample - t.average) - t.deviation) / 4;
+        t.average += (sample - t.average) / 8;
+    }
+    ++t.samples;
+    m_command = "";
+    unlock();
+}
+long long AdaptiveTimeout::getLastTimeout() const {
+    lock();
+    long long timeOut = m_lastTimeout;
+    unlock();
+    return timeOut;
+}
+long long AdaptiveTimeout::getTurnaround(const string &commandString) const {
+    long long turnaround = -1;
+    lock();
+    map<string, timing>::const_iterator t = m_timings.find(key(commandString));
+    if(t != m_timings.end() && t->second.samples >= minimumSamples) {
+        turnaround = (long long)t->second.average;
+    }
+    unlock();
+    return turnaround;
+}
+long long AdaptiveTimeout::getRoundTrip(const string &commandString) const {
+    long long roundTrip = -1;
+    lock();
+    map<string, timing>::const_iterator t = m_timings.find(key(commandString));
+    if(t != m_timings.end() && t->second.samples > 0) {
+        roundTrip = (long long)t->second.roundTrip;
+    }
+    unlock();
+    return roundTrip;
+}
+void AdaptiveTimeout::reset() {
+    lock();
+    m_timings.clear();
+    m_command = "";
+    unlock();
+}
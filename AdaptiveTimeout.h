@@ -0,0 +1,128 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#include <map>
+#include <string>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+namespace KClmtrBase {
+namespace KClmtrNative {
+/**
+ * @brief How long to wait for a reply, from how long this device has been taking to send it
+ * @details The time on the wire comes from the baud rate and the number of bytes.
+ * The rest is the time the device takes to get to it, which is learned from the replies
+ * that came back, like a TCP retransmit timer. It never waits longer than the command's own time out.
+ * The stream learns from its replies while other threads read the times, so every call takes its lock.
+ */
+class AdaptiveTimeout {
+public:
+    AdaptiveTimeout();
+    ~AdaptiveTimeout();
+    /**
+     * @brief How many times longer than normal a reply is waited for
+     * @param factor 0 turns it off, every command gets its own time out
+     */
+    void setSafetyFactor(double factor);
+    double getSafetyFactor() const;
+    /**
+     * @brief The least time past the wire time that is waited, so the device has time to answer
+     * @param margin_us microseconds, 20000 is the default
+     */
+    void setMinimumMargin(long long margin_us);
+    /**
+     * @brief A command was sent
+     * @param commandString The command, like "N5"
+     * @param expected The number of bytes coming back
+     * @param speed The baud rate it was sent at
+     */
+    void begin(const std::string &commandString, int expected, int speed);
+    /**
+     * @brief When to give up on the reply to the command from begin()
+     * @param timeOut_Sec The command's own time out
+     * @return microseconds from monotonicMicroseconds()
+     */
+    long long deadline(long timeOut_Sec);
+    /**
+     * @brief The reply came back, adds its time to what is known
+     */
+    void finish();
+    /**
+     * @brief The time begin() was given, for the last deadline()
+     * @return microseconds
+     */
+    long long getLastTimeout() const;
+    /**
+     * @brief The average time the device takes to get to a command, not counting the wire
+     * @return microseconds, -1 if it has not come back enough to know
+     */
+    long long getTurnaround(const std::string &commandString) const;
+    /**
+     * @brief The average time from sending a command to having all of its reply, wire and all
+     * @return microseconds, -1 if it has not come back yet
+     */
+    long long getRoundTrip(const std::string &commandString) const;
+    /**
+     * @brief Forgets every time, for when the device or baud rate changes
+     */
+    void reset();
+private:
+    struct timing {
+        double average;		//microseconds
+        double deviation;
+        double roundTrip;
+        int samples;
+    };
+    //A few are needed before the average can be trusted
+    static const int minimumSamples = 4;
+
+    AdaptiveTimeout(const AdaptiveTimeout &);
+    AdaptiveTimeout &operator=(const AdaptiveTimeout &);
+
+    static std::string key(const std::string &commandString);
+    long long wireTime() const;
+    void lock() const;
+    void unlock() const;
+
+#ifdef WIN32
+    mutable CRITICAL_SECTION m_lock;
+#else
+    mutable pthread_mutex_t m_lock;
+#endif
+
+    std::map<std::string, timing> m_timings;
+    double m_factor;
+    long long m_minimumMargin;
+    std::string m_command;
+    int m_commandLength;
+    int m_expected;
+    int m_speed;
+    long long m_sent;
+    long long m_lastTimeout;
+};
+}
+}
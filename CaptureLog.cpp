@@ -0,0 +1,137 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "CaptureLog.h"
+#include "Timing.h"
+
+using namespace std;
+using namespace KClmtrBase::KClmtrNative;
+
+static const char captureMagic[4] = {'K', 'C', 'A', 'P'};
+static const int captureVersion = 1;
+
+static bool readNumber(FILE *file, unsigned long long &v) {
+    v = 0;
+    for(int shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(file);
+        if(c == EOF) {
+            return false;
+        }
+        v |= (unsigned long long)(c & 0x7f) << shift;
+        if(!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+CaptureLog::CaptureLog() {
+    m_file = NULL;
+    m_lastTime = 0;
+}
+CaptureLog::~CaptureLog() {
+    close();
+}
+bool CaptureLog::open(const string &fileName) {
+    close();
+    lock_guard<mutex> guard(m_lock);
+    m_file = fopen(fileName.c_str(), "wb");
+    if(m_file == NULL) {
+        return false;
+    }
+    fwrite(captureMagic, 1, sizeof(captureMagic), m_file);
+    fputc(captureVersion, m_file);
+    m_lastTime = monotonicMicroseconds();
+    return true;
+}
+void CaptureLog::close() {
+    lock_guard<mutex> guard(m_lock);
+    if(m_file != NULL) {
+        fclose(m_file);
+        m_file = NULL;
+    }
+}
+bool CaptureLog::isOpen() const {
+    return m_file != NULL;
+}
+void CaptureLog::writeNumber(unsigned long long v) {
+    while(v >= 0x80) {
+        fputc((int)(v & 0x7f) | 0x80, m_file);
+        v >>= 7;
+    }
+    fputc((int)v, m_file);
+}
+void CaptureLog::record(CaptureRecord::Direction direction, const unsigned char *buf, size_t size) {
+    long long now = monotonicMicroseconds();
+    lock_guard<mutex> guard(m_lock);
+    if(m_file == NULL || size == 0) {
+        return;
+    }
+    fputc(direction, m_file);
+    writeNumber(now > m_lastTime ? now - m_lastTime : 0);
+    writeNumber(size);
+    fwrite(buf, 1, size, m_file);
+    if(now > m_lastTime) {
+        m_lastTime = now;
+    }
+}
+void CaptureLog::flush() {
+    lock_guard<mutex> guard(m_lock);
+    if(m_file != NULL) {
+        fflush(m_file);
+    }
+}
+bool CaptureLog::load(const string &fileName, vector<CaptureRecord> &records) {
+    records.clear();
+    FILE *file = fopen(fileName.c_str(), "rb");
+    if(file == NULL) {
+        return false;
+    }
+    char magic[sizeof(captureMagic)];
+    if(fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+            string(magic, sizeof(magic)) != string(captureMagic, sizeof(captureMagic)) ||
+            fgetc(file) != captureVersion) {
+        fclose(file);
+        return false;
+    }
+    long long time = 0;
+    int direction;
+    while((direction = fgetc(file)) != EOF) {
+        unsigned long long delta, size;
+        if(direction > CaptureRecord::SENT || !readNumber(file, delta) || !readNumber(file, size)) {
+            //Cut off at the end, keeping what is whole
+            break;
+        }
+        CaptureRecord r;
+        r.direction = (CaptureRecord::Direction)direction;
+        time += (long long)delta;
+        r.time = time;
+        r.bytes.resize((size_t)size);
+        if(size > 0 && fread(&r.bytes[0], 1, (size_t)size, file) != size) {
+            break;
+        }
+        records.push_back(r);
+    }
+    fclose(file);
+    return true;
+}
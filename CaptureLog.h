@@ -0,0 +1,87 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <mutex>
+
+namespace KClmtrBase {
+namespace KClmtrNative {
+/**
+ * @brief One read or write from a capture
+ */
+struct CaptureRecord {
+    enum Direction {
+        RECEIVED,	/**< From the device */
+        SENT		/**< To the device */
+    };
+    Direction direction;
+    long long time;		/**< Microseconds from the start of the capture */
+    std::string bytes;
+};
+
+/**
+ * @brief Saves every byte that goes over a Transport, with when it went
+ * @details The file starts with "KCAP" and a version byte. Each read or write after that is
+ * the direction byte, the microseconds since the last one, the number of bytes, then
+ * the bytes. The two numbers are 7 bits a byte with the top bit saying there is more,
+ * so most records have 3 bytes on top of the data.
+ * Play it back with FileReplayTransport.
+ */
+class CaptureLog {
+public:
+    CaptureLog();
+    ~CaptureLog();
+    /**
+     * @brief Starts a new file, anything in it is lost
+     */
+    bool open(const std::string &fileName);
+    void close();
+    bool isOpen() const;
+    /**
+     * @brief Adds a read or write, safe from any thread
+     */
+    void record(CaptureRecord::Direction direction, const unsigned char *buf, size_t size);
+    /**
+     * @brief Writes out what is buffered
+     */
+    void flush();
+    /**
+     * @brief Reads a whole capture
+     * @return false if it is not a capture file
+     */
+    static bool load(const std::string &fileName, std::vector<CaptureRecord> &records);
+private:
+    CaptureLog(const CaptureLog &);
+    CaptureLog &operator=(const CaptureLog &);
+
+    void writeNumber(unsigned long long v);
+
+    std::mutex m_lock;
+    FILE *m_file;
+    long long m_lastTime;
+};
+}
+}
@@ -0,0 +1,168 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "ConnectCache.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#ifdef WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+using namespace KClmtrBase::KClmtrNative;
+
+//2 is kept under the firmware from the device, the ones before can't be trusted
+static const int cacheVersion = 2;
+//The commands that can be saved, P4 was saved by version 1
+static const char cachedCommands[][3] = {"D7", "P4"};
+
+static string safeName(const string &s) {
+    string out = s;
+    for(size_t i = 0; i < out.size(); ++i) {
+        char c = out[i];
+        if(!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '-')) {
+            out[i] = '_';
+        }
+    }
+    return out;
+}
+static string trimmed(const string &s) {
+    size_t end = s.find_last_not_of(' ');
+    return end == string::npos ? "" : s.substr(0, end + 1);
+}
+static void makeDirectory(const string &directory) {
+    //Making each level, the ones already there fail and that's fine
+    for(size_t i = 1; i <= directory.size(); ++i) {
+        if(i == directory.size() || directory[i] == '/' || directory[i] == '\\') {
+            string level = directory.substr(0, i);
+#ifdef WIN32
+            _mkdir(level.c_str());
+#else
+            mkdir(level.c_str(), 0755);
+#endif
+        }
+    }
+}
+
+ConnectCache::ConnectCache() {
+}
+void ConnectCache::setDirectory(const string &directory) {
+    m_directory = directory;
+    if(!m_directory.empty()) {
+        makeDirectory(m_directory);
+    }
+}
+string ConnectCache::getDirectory() const {
+    return m_directory;
+}
+bool ConnectCache::isEnabled() const {
+    return !m_directory.empty();
+}
+string ConnectCache::defaultDirectory() {
+#ifdef WIN32
+    const char *base = getenv("LOCALAPPDATA");
+    return base == NULL ? "" : string(base) + "\\KClmtr\\cache";
+#else
+    const char *base = getenv("XDG_CACHE_HOME");
+    if(base != NULL && base[0] != '\0') {
+        return string(base) + "/kclmtr";
+    }
+    base = getenv("HOME");
+    return base == NULL ? "" : string(base) + "/.cache/kclmtr";
+#endif
+}
+string ConnectCache::fileName(const string &model, const string &serialNumber, const string &commandString) const {
+    return m_directory + "/" + safeName(trimmed(model)) + "_" + safeName(trimmed(serialNumber)) + "." + commandString;
+}
+bool ConnectCache::load(const string &model, const string &serialNumber, const string &firmware,
+                        const string &commandString, int expected, string &reply, long long &fetchTime) const {
+    if(!isEnabled() || serialNumber.empty() || firmware.empty()) {
+        return false;
+    }
+    ifstream file(fileName(model, serialNumber, commandString).c_str(), ios::in | ios::binary);
+    if(!file) {
+        return false;
+    }
+    //KClmtr cache <version> <firmware> <fetch time>
+    string header;
+    getline(file, header);
+    istringstream fields(header);
+    string name, cache, savedFirmware;
+    int version = 0;
+    fetchTime = 0;
+    fields >> name >> cache >> version >> savedFirmware >> fetchTime;
+    if(name != "KClmtr" || cache != "cache" || version != cacheVersion || savedFirmware != safeName(firmware)) {
+        return false;
+    }
+    stringstream contents;
+    contents << file.rdbuf();
+    reply = contents.str();
+
+    //The cheap checks, that it is whole and is the reply to the command
+    if((int)reply.size() != expected ||
+            reply.compare(0, commandString.size(), commandString) != 0 ||
+            reply.compare(reply.size() - 3, 3, "<0>") != 0) {
+        reply = "";
+        return false;
+    }
+    return true;
+}
+void ConnectCache::store(const string &model, const string &serialNumber, const string &firmware,
+                         const string &commandString, const string &reply, long long fetchTime) const {
+    if(!isEnabled() || serialNumber.empty() || firmware.empty()) {
+        return;
+    }
+    //Written to the side and moved in, so nobody reads half of it
+    string name = fileName(model, serialNumber, commandString);
+    string temp = name + ".tmp";
+    {
+        ofstream file(temp.c_str(), ios::out | ios::binary | ios::trunc);
+        if(!file) {
+            return;
+        }
+        file << "KClmtr cache " << cacheVersion << " " << safeName(firmware) << " " << fetchTime << "\n";
+        file.write(reply.data(), reply.size());
+        if(!file) {
+            return;
+        }
+    }
+#ifdef WIN32
+    ::remove(name.c_str());
+#endif
+    rename(temp.c_str(), name.c_str());
+}
+void ConnectCache::remove(const string &model, const string &serialNumber, const string &commandString) const {
+    if(!isEnabled()) {
+        return;
+    }
+    ::remove(fileName(model, serialNumber, commandString).c_str());
+}
+void ConnectCache::clear(const string &model, const string &serialNumber) const {
+    for(size_t i = 0; i < sizeof(cachedCommands) / sizeof(cachedCommands[0]); ++i) {
+        remove(model, serialNumber, cachedCommands[i]);
+    }
+}
@@ -0,0 +1,84 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#include <string>
+
+namespace KClmtrBase {
+namespace KClmtrNative {
+/**
+ * @brief Keeps the long replies that don't change, like the cal file list (D7), on disk for each device
+ * @details Each reply is a file named from the model, serial number and command, in the
+ * directory given to setDirectory(). The file starts with a line of text with the
+ * version, the firmware and how long it took to get from the device, then the reply.
+ * A reply is only used if it was saved under the firmware the device has now, is the right
+ * length and has the header and <0> trailer. Those checks only show the file is whole,
+ * checking it against the device is up to the caller, see KClmtr::setConnectCache().
+ */
+class ConnectCache {
+public:
+    ConnectCache();
+    /**
+     * @brief Where the replies are kept, "" turns the cache off
+     */
+    void setDirectory(const std::string &directory);
+    std::string getDirectory() const;
+    bool isEnabled() const;
+    /**
+     * @brief A directory for each user, like ~/.cache/kclmtr
+     */
+    static std::string defaultDirectory();
+
+    /**
+     * @brief Gets a saved reply
+     * @param model The model from P0
+     * @param serialNumber The serial number from P0
+     * @param firmware The firmware the device has now
+     * @param commandString The command, like "D7"
+     * @param expected The length of the reply
+     * @param reply The saved reply
+     * @param fetchTime How long it took to get from the device, in microseconds
+     * @return false if there is not one, or it did not pass the checks
+     */
+    bool load(const std::string &model, const std::string &serialNumber, const std::string &firmware,
+              const std::string &commandString, int expected, std::string &reply, long long &fetchTime) const;
+    /**
+     * @brief Saves a reply that came from the device, nothing is saved without the firmware
+     */
+    void store(const std::string &model, const std::string &serialNumber, const std::string &firmware,
+               const std::string &commandString, const std::string &reply, long long fetchTime) const;
+    /**
+     * @brief Throws away a saved reply
+     */
+    void remove(const std::string &model, const std::string &serialNumber, const std::string &commandString) const;
+    /**
+     * @brief Throws away everything saved for a device
+     */
+    void clear(const std::string &model, const std::string &serialNumber) const;
+private:
+    std::string fileName(const std::string &model, const std::string &serialNumber, const std::string &commandString) const;
+
+    std::string m_directory;
+};
+}
+}
@@ -32,6 +32,8 @@ Counts::Counts() {
     therm = 0;
     theCounts.initializeV(2, 3);
     errorcode = 0;
+    timestamp = 0;
+    sequence = 0;
 }
 Counts::Counts(const Counts &c) {
     th1 = c.th1;
@@ -42,6 +44,8 @@ Counts::Counts(const Counts &c) {
     bluerange = c.bluerange;
     theCounts = c.theCounts;
     errorcode = c.errorcode;
+    timestamp = c.timestamp;
+    sequence = c.sequence;
 }
 Counts::Counts(unsigned int error) {
     th1 = 0;
@@ -49,16 +53,24 @@ Counts::Counts(unsigned int error) {
     therm = 0;
     theCounts.initializeV(2, 3);
     errorcode = 0;
+    timestamp = 0;
+    sequence = 0;
     errorcode = error;
 }
 Counts::Counts(const std::string &s) {
+    parse((const unsigned char *)s.c_str());
+}
+Counts::Counts(const ByteView &s) {
+    parse(s.data);
+}
+void Counts::parse(const unsigned char *myRead) {
     th1 = 0;
     th2 = 0;
     therm = 0;
     theCounts.initializeV(2, 3);
     errorcode = 0;
-
-    const unsigned char *myRead = (const unsigned char *)s.c_str();
+    timestamp = 0;
+    sequence = 0;
 
     theCounts.v[0][0] = (int)myRead[0];
     theCounts.v[0][0] = theCounts.v[0][0] * 256 + (int)myRead[1];
@@ -85,7 +97,7 @@ Counts::Counts(const std::string &s) {
     th2 = (int)myRead[15];
 
     //Error
-    errorcode = KleinsErrorCodes::getErrorCodeFromKlein(s.substr(18, 1));
+    errorcode = KleinsErrorCodes::getErrorCodeFromKlein(std::string(1, (char)myRead[18]));
 
     //Ranges
     int ranges[3];
@@ -119,3 +131,9 @@ Matrix<int> Counts::getTheCounts() const {
 unsigned int Counts::getErrorCode() const {
     return errorcode;
 }
+long long Counts::getTimestamp() const {
+    return timestamp;
+}
+unsigned long Counts::getSequence() const {
+    return sequence;
+}
@@ -25,6 +25,7 @@ OTHER DEALINGS IN THE SOFTWARE.
 #pragma once
 #include "Matrix.h"
 #include "Enums.h"
+#include "RingBuffer.h"
 
 namespace KClmtrBase {
 namespace KClmtrNative {
@@ -39,12 +40,17 @@ public:
     MeasurementRange getBlueRange() const;  /**< Blue range  */
     Matrix<int> getTheCounts() const;		/**< 2x3 matrix of the top and bottom counts */
 	unsigned int getErrorCode() const;      /**< The error code whenever you are getting data  */
+    long long getTimestamp() const;         /**< When the last byte of the reply was read, in microseconds from monotonicMicroseconds(). 0 if it did not come from the device */
+    unsigned long getSequence() const;      /**< The number of the reply since the stream started, from 1. A gap means some were never seen */
 
     Counts();
     Counts(const Counts &c);
     Counts(const std::string &s);
+    Counts(const ByteView &s);
     Counts(unsigned int error);
 private:
+    void parse(const unsigned char *myRead);
+
     int th1;
     int th2;
     int therm;
@@ -53,6 +59,8 @@ private:
     MeasurementRange bluerange;
     Matrix<int> theCounts;
 	unsigned int errorcode;
+    long long timestamp;
+    unsigned long sequence;
 };
 }
 }
@@ -0,0 +1,234 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "FileReplayTransport.h"
+#include "Timing.h"
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace KClmtrBase::KClmtrNative;
+
+//The host write that a read in a capture waits for.
+//What came before any write was already on its way, it comes after the first one
+static size_t writeNeeded(size_t afterWrite) {
+    return afterWrite == 0 ? 1 : afterWrite;
+}
+
+FileReplayTransport::FileReplayTransport() {
+    m_readAt = 0;
+    m_open = false;
+    m_paced = true;
+    m_loop = false;
+    m_startTime = -1;
+    m_startAt = 0;
+    m_written = 0;
+    m_isCapture = false;
+    m_nextArrival = 0;
+    m_releasedEnd = 0;
+}
+FileReplayTransport::~FileReplayTransport() {
+    closePort();
+}
+bool FileReplayTransport::openPort() {
+    vector<CaptureRecord> records;
+    m_isCapture = CaptureLog::load(portName, records);
+    if(m_isCapture) {
+        loadCapture(records);
+    } else {
+        ifstream file(portName.c_str(), ios::in | ios::binary);
+        if(!file) {
+            return false;
+        }
+        stringstream contents;
+        contents << file.rdbuf();
+        m_data = contents.str();
+    }
+    m_writeTimes.clear();
+    m_nextArrival = 0;
+    m_releasedEnd = 0;
+    m_readAt = 0;
+    m_startTime = -1;
+    m_startAt = 0;
+    m_written = 0;
+    m_open = true;
+    return true;
+}
+void FileReplayTransport::loadCapture(const vector<CaptureRecord> &records) {
+    m_data.clear();
+    m_arrivals.clear();
+    size_t writes = 0;
+    long long lastWrite = records.empty() ? 0 : records[0].time;
+    for(size_t i = 0; i < records.size(); ++i) {
+        const CaptureRecord &r = records[i];
+        if(r.direction == CaptureRecord::SENT) {
+            ++writes;
+            lastWrite = r.time;
+            continue;
+        }
+        m_data += r.bytes;
+        arrival a;
+        a.end = m_data.size();
+        a.afterWrite = writes;
+        a.gap = r.time - lastWrite;
+        m_arrivals.push_back(a);
+    }
+}
+bool FileReplayTransport::closePort() {
+    bool wasOpen = m_open;
+    m_open = false;
+    m_data.clear();
+    m_arrivals.clear();
+    m_writeTimes.clear();
+    m_rxBuffer.clear();
+    return wasOpen;
+}
+bool FileReplayTransport::isOpen() {
+    return m_open;
+}
+bool FileReplayTransport::setSetting(int speed, int, char, int) {
+    m_speed = speed;
+    //Keeps the bytes that already came at the old speed
+    if(m_startTime != -1) {
+        m_startAt = m_readAt;
+        m_startTime = monotonicMicroseconds();
+    }
+    return m_open;
+}
+int FileReplayTransport::writeSome(const unsigned char *, size_t bufSize) {
+    if(!m_open) {
+        return -1;
+    }
+    if(m_startTime == -1) {
+        m_startTime = monotonicMicroseconds();
+        m_startAt = m_readAt;
+    }
+    if(m_isCapture) {
+        m_writeTimes.push_back(monotonicMicroseconds());
+    }
+    m_written += bufSize;
+    return (int)bufSize;
+}
+void FileReplayTransport::setPaced(bool paced) {
+    m_paced = paced;
+}
+void FileReplayTransport::setLoop(bool loop) {
+    m_loop = loop;
+}
+unsigned long long FileReplayTransport::written() const {
+    return m_written;
+}
+bool FileReplayTransport::isCapture() const {
+    return m_isCapture;
+}
+size_t FileReplayTransport::releasedCapture() {
+    if(m_loop && m_readAt == m_data.size() && m_nextArrival == m_arrivals.size() && !m_writeTimes.empty()) {
+        //Starting over from the last write, as if it was the first one in the capture
+        long long lastWrite = m_writeTimes.back();
+        m_writeTimes.assign(1, lastWrite);
+        m_readAt = 0;
+        m_nextArrival = 0;
+        m_releasedEnd = 0;
+    }
+    long long now = monotonicMicroseconds();
+    while(m_nextArrival < m_arrivals.size()) {
+        const arrival &a = m_arrivals[m_nextArrival];
+        size_t write = writeNeeded(a.afterWrite);
+        if(m_writeTimes.size() < write) {
+            break;
+        }
+        if(m_paced && now < m_writeTimes[write - 1] + a.gap) {
+            break;
+        }
+        m_releasedEnd = a.end;
+        ++m_nextArrival;
+    }
+    return m_releasedEnd;
+}
+size_t FileReplayTransport::released() {
+    if(m_isCapture) {
+        return releasedCapture();
+    }
+    if(m_startTime == -1) {
+        return m_readAt;
+    }
+    if(m_loop && m_readAt == m_data.size()) {
+        m_readAt = 0;
+        m_startAt = 0;
+        m_startTime = monotonicMicroseconds();
+    }
+    if(!m_paced || m_speed <= 0) {
+        return m_data.size();
+    }
+    //10 bits on the wire for each byte
+    long long elapsed = monotonicMicroseconds() - m_startTime;
+    size_t arrived = m_startAt + (size_t)(elapsed * (m_speed / 10) / 1000000);
+    return arrived < m_data.size() ? arrived : m_data.size();
+}
+int FileReplayTransport::readSome(unsigned char *buf, size_t max) {
+    if(!m_open) {
+        return -1;
+    }
+    size_t n = released() - m_readAt;
+    if(n > max) {
+        n = max;
+    }
+    memcpy(buf, m_data.data() + m_readAt, n);
+    m_readAt += n;
+    return (int)n;
+}
+bool FileReplayTransport::waitReadable(long timeOut_ms) {
+    if(!m_open) {
+        return false;
+    }
+    long long deadline = monotonicMicroseconds() + (long long)timeOut_ms * 1000;
+    while(released() == m_readAt) {
+        if(isCancelled()) {
+            return false;
+        }
+        if(m_isCapture) {
+            //Nothing more is coming until the host writes, or at the end
+            if(!m_paced || m_nextArrival == m_arrivals.size() ||
+                    m_writeTimes.size() < writeNeeded(m_arrivals[m_nextArrival].afterWrite) ||
+                    monotonicMicroseconds() >= deadline) {
+                return false;
+            }
+        } else if(!m_paced || m_speed <= 0 || m_startTime == -1 || m_readAt == m_data.size() ||
+                  monotonicMicroseconds() >= deadline) {
+            //Nothing more is coming if it is not paced or at the end
+            return false;
+        }
+#ifdef WIN32
+        Sleep(1);
+#else
+        usleep(500);
+#endif
+    }
+    return true;
+}
@@ -0,0 +1,106 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#include <vector>
+#include "Transport.h"
+#include "CaptureLog.h"
+
+namespace KClmtrBase {
+namespace KClmtrNative {
+/**
+ * @brief Plays back bytes that were saved from a device, portName is the file to play
+ * @details The file can be a capture from KClmtr::startCapture(), or just the bytes.
+ * A capture plays each read back after the write it came after, with the same wait
+ * in between that it had. With setPaced(false) it does not wait, but still holds each
+ * reply until its command has been written.
+ * Plain bytes start coming after the first write, as fast as the baud rate from
+ * setSetting() would bring them, or all at once with setPaced(false).
+ * What the host writes is counted and thrown away.
+ */
+class FileReplayTransport : public Transport {
+public:
+    FileReplayTransport();
+    virtual ~FileReplayTransport();
+    /**
+     * @brief Loads the whole file in portName
+     */
+    bool openPort();
+    bool closePort();
+    bool isOpen();
+    /**
+     * @brief The speed sets how fast the bytes come back
+     */
+    bool setSetting(int speed, int wordSize, char parity, int timeOut);
+    /**
+     * @brief true to play at the speed it was saved, false to hand it out as soon as it can be
+     */
+    void setPaced(bool paced);
+    /**
+     * @brief Starts over at the end of the file, for long benchmarks
+     */
+    void setLoop(bool loop);
+    /**
+     * @brief The number of bytes written to it since it was opened
+     */
+    unsigned long long written() const;
+    /**
+     * @brief If portName was a capture and not just the bytes
+     */
+    bool isCapture() const;
+protected:
+    int readSome(unsigned char *buf, size_t max);
+    bool waitReadable(long timeOut_ms);
+    int writeSome(const unsigned char *buf, size_t bufSize);
+private:
+    //How many bytes can be read by now
+    size_t released();
+    size_t releasedCapture();
+    void loadCapture(const std::vector<CaptureRecord> &records);
+
+    //A read from the capture, the bytes up to end come gap microseconds
+    //after the host's write number afterWrite
+    struct arrival {
+        size_t end;
+        size_t afterWrite;
+        long long gap;
+    };
+    bool m_isCapture;
+    std::vector<arrival> m_arrivals;
+    size_t m_nextArrival;
+    size_t m_releasedEnd;
+    std::vector<long long> m_writeTimes;
+
+    std::string m_data;
+    size_t m_readAt;
+    bool m_open;
+    bool m_paced;
+    bool m_loop;
+    //When the first write was, -1 before that
+    long long m_startTime;
+    //m_readAt when the pacing started
+    size_t m_startAt;
+    unsigned long long m_written;
+};
+}
+}
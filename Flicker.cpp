@@ -218,6 +218,12 @@ const FlickerSetting &Flicker::getSettings() const {
 double Flicker::getFlickerIndex() const {
     return flickerIndex;
 }
+long long Flicker::getTimestamp() const {
+    return timestamp;
+}
+unsigned long Flicker::getSequence() const {
+    return sequence;
+}
 
 Flicker::Flicker() {
     bigY = 0;
@@ -233,6 +239,8 @@ Flicker::Flicker() {
     counts.initializeV(0, 0);
     nits.initializeV(0, 0);
     settings = FlickerSetting();
+    timestamp = 0;
+    sequence = 0;
 }
 Flicker::Flicker(unsigned int error) {
     bigY = 0;
@@ -248,6 +256,8 @@ Flicker::Flicker(unsigned int error) {
     counts.initializeV(0, 0);
     nits.initializeV(0, 0);
     settings = FlickerSetting();
+    timestamp = 0;
+    sequence = 0;
     errorcode = error;
 }
 
@@ -265,9 +275,13 @@ Flicker::Flicker(const Flicker &f) {
     counts = f.counts;
     nits = f.nits;
     settings = f.settings;
+    timestamp = f.timestamp;
+    sequence = f.sequence;
 }
 Flicker::Flicker(const FlickerSetting &_settings, const double data[], int sectionOfFFT, double nitsLast32Samples) {
     settings = _settings;
+    timestamp = 0;
+    sequence = 0;
 
     int numberInArray = (settings.samples / 2) - (28 * settings.samples / 256)  + 1;   //Example: 256 samples = 128, but will only use 100hz, we dropping 28 Hzs, +1 for DC at 0
     amplitude.initializeV(numberInArray, 2);
@@ -151,6 +151,8 @@ public:
     const Matrix<double> &getNits() const;					/**< The nits over Time */
     const Matrix<double> &getAmplitude() const;			/**< The amplitude */
 	unsigned int getErrorCode() const;				/**< The error code whenever you are getting data  */
+    long long getTimestamp() const;					/**< When the last byte of the frame that finished it was read, in microseconds from monotonicMicroseconds() */
+    unsigned long getSequence() const;				/**< The number of that frame since the flicker started, from 1. A gap means some were never seen */
     const FlickerSetting &getSettings() const;				/**< The settings used to create the Flicker */
     double getFlickerIndex() const;
 
@@ -172,6 +174,8 @@ private:
 	unsigned int errorcode;
     FlickerSetting settings;
     double flickerIndex;
+    long long timestamp;
+    unsigned long sequence;
 
     Flicker(const FlickerSetting &_settings, const double data[], int sectionOfFFT = 0, double nitsLast32Samples = -1);
 };
@@ -0,0 +1,242 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "FrameDecoder.h"
+#include <cstring>
+
+using namespace std;
+using namespace KClmtrBase::KClmtrNative;
+
+static size_t frameLength(Frame::Type type) {
+    switch(type) {
+        case Frame::COLOR:
+            return 15;
+        case Frame::COUNTS:
+            return 20;
+        case Frame::DEVICE_INFO:
+            return 21;
+        case Frame::FLICKER_INFO:
+            return 613;
+        case Frame::CALFILE_LIST:
+            return 1925;
+        case Frame::BLACKCAL:
+            return 43;
+        case Frame::COEFFICIENT:
+            return 133;
+        case Frame::FLICKER:
+            return 96;
+        default:
+            return 0;
+    }
+}
+
+FrameDecoder::FrameDecoder() {
+    m_type = Frame::NONE;
+    m_length = 0;
+    m_discarded = 0;
+    reset();
+}
+void FrameDecoder::reset() {
+    m_start = 0;
+    m_end = 0;
+    m_checked = 0;
+    m_emitted = false;
+}
+void FrameDecoder::expect(const string &commandString, int expected) {
+    reset();
+    m_header = "";
+    m_length = expected > 0 ? (size_t)expected : 0;
+
+    if(expected < 0) {
+        if(!commandString.empty() && commandString[0] == 'T') {
+            //T1 and T2 keep sending 96 byte frames until they are stopped
+            m_type = Frame::FLICKER;
+            m_header = "T";
+            m_length = 96;
+        } else {
+            m_type = Frame::NONE;
+        }
+    } else if(expected == 0) {
+        m_type = Frame::NONE;
+    } else if(commandString.size() == 2 && commandString[0] == 'N' &&
+              commandString[1] >= '4' && commandString[1] <= '7') {
+        m_type = Frame::COLOR;
+        m_header = commandString;
+    } else if(commandString == "M6") {
+        //The counts come back without the command in front
+        m_type = Frame::COUNTS;
+    } else if(commandString == "P0") {
+        m_type = Frame::DEVICE_INFO;
+        m_header = commandString;
+    } else if(commandString == "P4") {
+        m_type = Frame::FLICKER_INFO;
+        m_header = commandString;
+    } else if(commandString == "D7") {
+        m_type = Frame::CALFILE_LIST;
+        m_header = commandString;
+    } else if(commandString == "B4" || commandString == "B8" || commandString == "B9") {
+        m_type = Frame::BLACKCAL;
+        m_header = commandString;
+    } else if(commandString == "S0") {
+        m_type = Frame::COEFFICIENT;
+        m_header = commandString;
+    } else {
+        m_type = Frame::REPLY;
+    }
+    if(m_type != Frame::NONE && m_type != Frame::REPLY && m_length != frameLength(m_type)) {
+        //Not the reply we know about, so only the length can be used
+        m_type = Frame::REPLY;
+        m_header = "";
+    }
+    if(m_length > maxFrame) {
+        m_length = maxFrame;
+    }
+}
+Frame::Type FrameDecoder::expecting() const {
+    return m_type;
+}
+int FrameDecoder::needed() const {
+    if(m_type == Frame::NONE) {
+        return 0;
+    }
+    if(m_emitted) {
+        return (int)m_length;
+    }
+    return (int)(m_length - (m_end - m_start));
+}
+unsigned long long FrameDecoder::discarded() const {
+#ifdef __GNUC__
+    return __atomic_load_n(&m_discarded, __ATOMIC_RELAXED);
+#else
+    return m_discarded;
+#endif
+}
+void FrameDecoder::addDiscarded(size_t bytes) {
+#ifdef __GNUC__
+    //One writer, so it only has to be read whole, not torn on 32 bit
+    __atomic_store_n(&m_discarded, m_discarded + bytes, __ATOMIC_RELAXED);
+#else
+    m_discarded += bytes;
+#endif
+}
+bool FrameDecoder::check(size_t i) const {
+    unsigned char c = m_buffer[m_start + i];
+    if(i < m_header.size()) {
+        return c == (unsigned char)m_header[i];
+    }
+    switch(m_type) {
+        case Frame::FLICKER:
+            //Every third byte spells out a N5 reply followed by '_'
+            //The other two are the samples, and can be anything
+            if(i % 3 != 0) {
+                return true;
+            }
+            if(i == 3) {
+                return c == '2';
+            }
+            if(i == 42) {
+                return c == '>';
+            }
+            return i < 45 || c == '_';
+        case Frame::COLOR:
+        case Frame::COUNTS:
+        case Frame::DEVICE_INFO:
+        case Frame::BLACKCAL:
+            //Ends with <e>
+            if(i == m_length - 3) {
+                return c == '<';
+            }
+            if(i == m_length - 1) {
+                return c == '>';
+            }
+            return true;
+        default:
+            return true;
+    }
+}
+void FrameDecoder::validate() {
+    while(m_checked < m_end - m_start) {
+        if(check(m_checked)) {
+            ++m_checked;
+        } else {
+            resync();
+        }
+    }
+}
+void FrameDecoder::resync() {
+    //Finding the next byte that could start a frame
+    size_t next = 1;
+    if(!m_header.empty()) {
+        const void *found = memchr(m_buffer + m_start + 1, m_header[0], m_end - m_start - 1);
+        next = found == NULL ? m_end - m_start : (const unsigned char *)found - (m_buffer + m_start);
+    }
+    addDiscarded(next);
+    m_start += next;
+    m_checked = 0;
+    if(m_start == m_end) {
+        reset();
+    }
+}
+size_t FrameDecoder::feed(const ByteView &bytes, Frame &frame) {
+    return feed(bytes.data, bytes.size, frame);
+}
+size_t FrameDecoder::feed(const unsigned char *data, size_t size, Frame &frame) {
+    frame.type = Frame::NONE;
+    frame.bytes = ByteView();
+    if(m_emitted) {
+        //The last frame has been used
+        reset();
+    }
+    if(m_type == Frame::NONE) {
+        //Nothing should be coming
+        addDiscarded(size);
+        return size;
+    }
+
+    size_t used = 0;
+    while(used < size) {
+        size_t have = m_end - m_start;
+        size_t take = m_length - have;
+        if(take > size - used) {
+            take = size - used;
+        }
+        if(m_end + take > sizeof(m_buffer)) {
+            memmove(m_buffer, m_buffer + m_start, have);
+            m_start = 0;
+            m_end = have;
+        }
+        memcpy(m_buffer + m_end, data + used, take);
+        m_end += take;
+        used += take;
+
+        validate();
+        if(m_end - m_start == m_length) {
+            //Every byte passed
+            frame.type = m_type;
+            frame.bytes = ByteView(m_buffer + m_start, m_length);
+            m_emitted = true;
+            return used;
+        }
+    }
+    return used;
+}
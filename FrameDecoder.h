@@ -0,0 +1,119 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#include <string>
+#include "RingBuffer.h"
+
+namespace KClmtrBase {
+namespace KClmtrNative {
+/**
+ * @brief One reply from the Klein device that has passed all of its checks
+ */
+struct Frame {
+    enum Type {
+        NONE,			/**< Nothing complete yet */
+        COLOR,			/**< N4, N5, N6, N7 - 15 bytes */
+        COUNTS,			/**< M6 - 20 bytes */
+        DEVICE_INFO,	/**< P0 - 21 bytes */
+        FLICKER_INFO,	/**< P4 - 613 bytes */
+        CALFILE_LIST,	/**< D7 - 1925 bytes */
+        BLACKCAL,		/**< B4, B8, B9 - 43 bytes */
+        COEFFICIENT,	/**< S0 - 133 bytes */
+        FLICKER,		/**< T1, T2 - 96 bytes, over and over */
+        REPLY			/**< Anything else, only the length is known */
+    };
+    Type type;
+    ByteView bytes;	/**< Good until the next time the decoder is used */
+    long long time;	/**< When the read with its last byte came back, from monotonicMicroseconds() */
+
+    Frame() {
+        type = NONE;
+        time = 0;
+    }
+};
+
+/**
+ * @brief Turns bytes from the port into frames, one byte at a time if needed
+ * @details Tell it what command was sent with expect(), then feed() it whatever
+ * shows up. Headers, trailers and the flicker markers are checked as the bytes come in.
+ * When a check fails it moves on to the next byte that could start a frame,
+ * so each byte is only looked at a fixed number of times.
+ */
+class FrameDecoder {
+public:
+    FrameDecoder();
+    /**
+     * @brief Sets up for the reply of a command that is about to be sent
+     * @param commandString The command, like "N5"
+     * @param expected How many bytes come back, -1 if nothing (or a stream) comes back
+     */
+    void expect(const std::string &commandString, int expected);
+    /**
+     * @brief Throws away the bytes of a frame that has not finished
+     */
+    void reset();
+    /**
+     * @brief Adds bytes until one frame is done
+     * @param data The bytes from the port
+     * @param size The number of bytes
+     * @param frame The finished frame, or type NONE
+     * @return The number of bytes that were used, the rest belong to the next call
+     */
+    size_t feed(const unsigned char *data, size_t size, Frame &frame);
+    size_t feed(const ByteView &bytes, Frame &frame);
+    /**
+     * @brief The number of bytes still needed to finish the current frame
+     */
+    int needed() const;
+    /**
+     * @brief What it is looking for
+     */
+    Frame::Type expecting() const;
+    /**
+     * @brief Bytes thrown away looking for the start of a frame, it can be read from any thread
+     */
+    unsigned long long discarded() const;
+private:
+    //The biggest frame is the cal file list
+    static const size_t maxFrame = 2048;
+
+    bool check(size_t i) const;
+    void validate();
+    void resync();
+    void addDiscarded(size_t bytes);
+
+    Frame::Type m_type;
+    std::string m_header;
+    size_t m_length;
+
+    unsigned char m_buffer[maxFrame * 2];
+    size_t m_start;		//first byte of the frame being built
+    size_t m_end;		//one past the last byte
+    size_t m_checked;	//bytes from m_start that have passed
+    bool m_emitted;		//The frame at m_start was handed out and can be dropped
+    //Only the feeding thread adds to it
+    volatile unsigned long long m_discarded;
+};
+}
+}
@@ -22,6 +22,9 @@ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 OTHER DEALINGS IN THE SOFTWARE.
 */
 #include "KClmtr.h"
+#include "Timing.h"
+#include "CaptureLog.h"
+#include "KClmtrReactor.h"
 
 #ifdef WIN32
 #include <process.h>
@@ -29,6 +32,7 @@ OTHER DEALINGS IN THE SOFTWARE.
 #include <unistd.h>
 #endif
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 
@@ -66,13 +70,27 @@ KClmtr::command KClmtr::RANGE_FIXCURRENT			= {"J7",    1, 2}; //Stops AutoRangin
 KClmtr::command KClmtr::RANGE_AUTO					= {"J8",    1, 2}; //Start AutoRanging
 KClmtr::command KClmtr::DUMMY						= {"X9",   -1, 1 }; //To stop flicker, and other dummy things
 
-static void sleep(int ms) {
-#ifdef WIN32
-    Sleep((DWORD)ms);
+//The port always starts out at this
+static const int defaultBaudRate = 9600;
+//The new firmware switches to this on its own for T1
+static const int newFlickerBaudRate = 9600 * 2;
+//How many byte times without anything coming in means a flicker stream has stopped
+static const long flickerQuietBytes = 16;
+//Most of them go through a FTDI chip, which holds bytes for up to 16 ms
+#ifdef __linux__
+//No latency_timer means it is not behind a USB adapter
+static const long unknownLatency_us = 0;
 #else
-    usleep(ms * 1000);
+static const long unknownLatency_us = 16000;
 #endif
-}
+//Longest to wait for the port to go quiet after X9, a few flicker frames
+static const long flickerQuietLimit = 1000;
+//Flicker frames waiting for the FFT thread, with skipStale it only gets past 1 while a window is being worked on
+static const size_t flickerWindowQueue = 8;
+//Where P4 has the names of the first 10 cal files, after the header, model, serial number, firmware and FFT matrices
+static const size_t startupNamesStart = 2 + 16 + 8 + 384;
+//Rates tried by detectBaudRate() after the current one, fastest first
+static const int negotiableBaudRates[] = {921600, 460800, 230400, 115200, 57600, 38400, 19200, 9600};
 
 static string trim(const string &s) {
     size_t begin = s.find_first_not_of(" \t\n\r");
@@ -114,6 +132,13 @@ static void polyFit(const Matrix<double> &data, unsigned int degree, double cons
 KClmtr::KClmtr() {
     //Objects
     m_isOpen = false;
+    m_transport = &m_CommPort;
+    m_capture = NULL;
+    m_cacheHits = 0;
+    m_cacheMisses = 0;
+    m_cacheTimeSaved = 0;
+    m_baudRate = defaultBaudRate;
+    m_lastThroughput = 0;
     threadId = 0;
     //Variables
     //The Serial Number of the K10/8
@@ -129,6 +154,67 @@ KClmtr::KClmtr() {
     //N5 Constant measuring flag
     m_MeasuringN5 = false;
     m_speedMode = SpeedMode::SPEEDMODE_NORMAL;
+    m_measurePipelined = false;
+    m_measureInFlight = false;
+    m_reactor = NULL;
+    m_streamReactor = NULL;
+    m_streamDeadline = 0;
+    m_frameSequence = 0;
+    m_overrunBase = 0;
+    m_discardedBase = 0;
+    m_discardedSeen = 0;
+    m_framesDelivered = 0;
+    m_framesDropped = 0;
+    m_measureFrames = 0;
+    m_firstMeasureTime = 0;
+    m_lastMeasureTime = 0;
+    m_lastQueueWait = 0;
+    m_lastStopWait = 0;
+    m_drainUntil = 0;
+    m_flickerStartAt = 0;
+    m_flickerStopAt = 0;
+    m_flickerLastX9 = false;
+    m_flickerQuiet_us = 0;
+    m_lastFlickerStart = 0;
+    m_lastFlickerStop = 0;
+#ifdef WIN32
+    InitializeCriticalSection(&m_queueLock);
+    InitializeCriticalSection(&m_threadLock);
+    InitializeConditionVariable(&m_threadChanged);
+#else
+    pthread_mutex_init(&m_queueLock, NULL);
+    pthread_mutex_init(&m_threadLock, NULL);
+#ifdef __APPLE__
+    //No clock can be set, waitThreadUntil() waits for a relative time instead
+    pthread_cond_init(&m_threadChanged, NULL);
+#else
+    //On the same clock as monotonicMicroseconds(), so waitThreadUntil() isn't moved by the wall clock
+    pthread_condattr_t monotonic;
+    pthread_condattr_init(&monotonic);
+    pthread_condattr_setclock(&monotonic, CLOCK_MONOTONIC);
+    pthread_cond_init(&m_threadChanged, &monotonic);
+    pthread_condattr_destroy(&monotonic);
+#endif
+    m_streamJoinable = false;
+#endif
+#ifdef WIN32
+    InitializeCriticalSection(&m_callbackLock);
+    InitializeConditionVariable(&m_callbackChanged);
+    m_callbackThreadId = 0;
+#else
+    pthread_mutex_init(&m_callbackLock, NULL);
+    pthread_cond_init(&m_callbackChanged, NULL);
+#endif
+    m_callbackRunning = false;
+    m_callbackStopping = false;
+    m_analysisRunning = false;
+    m_analysisStopping = false;
+    m_analysisBusy = false;
+    m_skipStaleWindows = true;
+    m_flickerWindowsSkipped = 0;
+#ifdef WIN32
+    m_analysisThreadId = 0;
+#endif
     //M6 Constant measuring flag
     m_MeasuringM6 = false;
 
@@ -178,6 +264,7 @@ KClmtr::KClmtr() {
 
     threadModeParent = NOT_RUNNING;
     threadModeChild = NOT_RUNNING;
+    m_childStarts = 0;
 #ifdef WIN32
     threadH = 0;
 #endif
@@ -190,16 +277,169 @@ KClmtr::KClmtr() {
 
 KClmtr::~KClmtr() {
     closePort();
+    //A stream that ended on its own still has to be joined
+    joinStreamThread();
+    stopAnalysisThread();
+    stopCallbackThread();
+    m_transport->setCapture(NULL);
+    delete m_capture;
+#ifdef WIN32
+    DeleteCriticalSection(&m_queueLock);
+    DeleteCriticalSection(&m_threadLock);
+#else
+    pthread_mutex_destroy(&m_queueLock);
+    pthread_mutex_destroy(&m_threadLock);
+    pthread_cond_destroy(&m_threadChanged);
+#endif
+#ifdef WIN32
+    DeleteCriticalSection(&m_callbackLock);
+#else
+    pthread_mutex_destroy(&m_callbackLock);
+    pthread_cond_destroy(&m_callbackChanged);
+#endif
 }
 void KClmtr::setPort(const string &portName) {
-    m_CommPort.portName = trim(portName);
+    m_transport->portName = trim(portName);
 }
 string KClmtr::getPort() const {
-    return m_CommPort.portName;
+    return m_transport->portName;
+}
+
+void KClmtr::setTransport(Transport *transport) {
+    closePort();
+    m_transport->setCapture(NULL);
+    m_transport = transport == NULL ? &m_CommPort : transport;
+    m_transport->setCapture(m_capture);
+}
+Transport *KClmtr::getTransport() {
+    return m_transport;
+}
+bool KClmtr::startCapture(const string &fileName) {
+    //Kept until the end, the thread could be in the middle of saving to it
+    if(m_capture == NULL) {
+        m_capture = new CaptureLog();
+    }
+    if(!m_capture->open(fileName)) {
+        return false;
+    }
+    m_transport->setCapture(m_capture);
+    return true;
+}
+void KClmtr::stopCapture() {
+    if(m_capture != NULL) {
+        m_capture->close();
+    }
+}
+bool KClmtr::isCapturing() const {
+    return m_capture != NULL && m_capture->isOpen();
+}
+void KClmtr::setConnectCache(const string &directory) {
+    m_connectCache.setDirectory(directory);
+}
+string KClmtr::getConnectCache() const {
+    return m_connectCache.getDirectory();
+}
+int KClmtr::getCacheHits() const {
+    return m_cacheHits;
+}
+int KClmtr::getCacheMisses() const {
+    return m_cacheMisses;
+}
+long long KClmtr::getCacheTimeSaved() const {
+    return m_cacheTimeSaved;
+}
+void KClmtr::clearConnectCache() {
+    m_connectCache.clear(m_Model, m_SerialNumber);
+}
+bool KClmtr::loadCachedCalFileList(const string &startupString, string &readString) {
+    const command &m = CALFILE_FILELIST;
+    long long start = monotonicMicroseconds();
+    long long fetchTime;
+    if(m_connectCache.load(m_Model, m_SerialNumber, m_firmware, m.commandString, m.expected, readString, fetchTime)) {
+        //P4 has the names of the first 10 cal files, straight from the device
+        for(int i = 0; i < 10; ++i) {
+            if(startupString.compare(startupNamesStart + i * 20, 20, readString, 2 + i * 20, 20) != 0) {
+                m_connectCache.remove(m_Model, m_SerialNumber, m.commandString);
+                readString = "";
+                return false;
+            }
+        }
+        long long saved = fetchTime - (monotonicMicroseconds() - start);
+        if(saved < 0) {
+            saved = 0;
+        }
+        ++m_cacheHits;
+        m_cacheTimeSaved += saved;
+        printCache(m.commandString, true, saved);
+        return true;
+    }
+    return false;
+}
+unsigned int KClmtr::fetchAndCache(const command &m, string &readString) {
+    long long start = monotonicMicroseconds();
+    unsigned int error = sendMessageToKColorimeter(m, readString);
+    if(error == KleinsErrorCodes::NONE) {
+        m_connectCache.store(m_Model, m_SerialNumber, m_firmware, m.commandString, readString, monotonicMicroseconds() - start);
+    }
+    return error;
+}
+long KClmtr::getLastReadLatency() const {
+    return m_transport->getLastReadLatency();
+}
+double KClmtr::getThroughput() const {
+    return m_lastThroughput;
+}
+bool KClmtr::setBaudRate(int speed) {
+    //Only the host side would change, the device would still be at the old rate
+    if(m_transport->isOpen()) {
+        return false;
+    }
+    m_baudRate = speed;
+    return true;
 }
+int KClmtr::getBaudRate() const {
+    return m_baudRate;
+}
+int KClmtr::detectBaudRate(int maxSpeed) {
+    if(!m_transport->isOpen()) {
+        return 0;
+    }
+    if(isMeasuring()) {
+        stopMeasuring();
+    }
+    if(isMeasureCounts()) {
+        stopMeasureCounts();
+    }
+    if(isFlickering()) {
+        stopFlicker();
+    }
 
+    string model, SN;
+    const size_t rates = sizeof(negotiableBaudRates) / sizeof(negotiableBaudRates[0]);
+    for(size_t i = 0; i <= rates; ++i) {
+        //The rate in use is the likely one, it is checked before paying a timeout on the others
+        int speed = i == 0 ? m_baudRate : negotiableBaudRates[i - 1];
+        if((i > 0 && speed == m_baudRate) || speed > maxSpeed || !m_transport->setSetting(speed, 8, 'n', 10000)) {
+            continue;
+        }
+        //It has to be the same device answering, not line noise that looks like it
+        if(getModelSN(*m_transport, model, SN) && SN == m_SerialNumber) {
+            m_baudRate = speed;
+            return speed;
+        }
+    }
+    //Going back to what worked before
+    m_transport->setSetting(m_baudRate, 8, 'n', 10000);
+    return 0;
+}
+void KClmtr::setThroughput(size_t bytes, long long startTime) {
+    long long elapsed = monotonicMicroseconds() - startTime;
+    if(bytes > 0 && elapsed > 0) {
+        m_lastThroughput = bytes * 1000000.0 / elapsed;
+    }
+}
 bool KClmtr::isPortOpen() {
-    bool isOpen = m_CommPort.isOpen();
+    bool isOpen = m_transport->isOpen();
     if(m_isOpen && !isOpen) {
         closePort();
     }
@@ -224,37 +464,44 @@ int KClmtr::getRange() const {
 
 void KClmtr::setRange(int range) {
     m_range = range;
-    switch(m_range) {
+    vector<command> batch;
+    rangeCommands(m_range, batch);
+    vector<batchReply> replies;
+    sendBatchToKColorimeter(batch, replies);
+}
+void KClmtr::rangeCommands(int range, vector<command> &batch) {
+    //Stopping the autorange first, then going to the range
+    switch(range) {
         case 0:
-            sendMessageToKColorimeter(RANGE_FIXCURRENT);
+            batch.push_back(RANGE_FIXCURRENT);
             break;
         case 1:
-            sendMessageToKColorimeter(RANGE_FIXCURRENT);
-            sendMessageToKColorimeter(RANGE_FIX1);
+            batch.push_back(RANGE_FIXCURRENT);
+            batch.push_back(RANGE_FIX1);
             break;
         case 2:
-            sendMessageToKColorimeter(RANGE_FIXCURRENT);
-            sendMessageToKColorimeter(RANGE_FIX2);
+            batch.push_back(RANGE_FIXCURRENT);
+            batch.push_back(RANGE_FIX2);
             break;
         case 3:
-            sendMessageToKColorimeter(RANGE_FIXCURRENT);
-            sendMessageToKColorimeter(RANGE_FIX3);
+            batch.push_back(RANGE_FIXCURRENT);
+            batch.push_back(RANGE_FIX3);
             break;
         case 4:
-            sendMessageToKColorimeter(RANGE_FIXCURRENT);
-            sendMessageToKColorimeter(RANGE_FIX4);
+            batch.push_back(RANGE_FIXCURRENT);
+            batch.push_back(RANGE_FIX4);
             break;
         case 5:
-            sendMessageToKColorimeter(RANGE_FIXCURRENT);
-            sendMessageToKColorimeter(RANGE_FIX5);
+            batch.push_back(RANGE_FIXCURRENT);
+            batch.push_back(RANGE_FIX5);
             break;
         case 6:
-            sendMessageToKColorimeter(RANGE_FIXCURRENT);
-            sendMessageToKColorimeter(RANGE_FIX6);
+            batch.push_back(RANGE_FIXCURRENT);
+            batch.push_back(RANGE_FIX6);
             break;
         case -1:
         default:
-            sendMessageToKColorimeter(RANGE_AUTO);
+            batch.push_back(RANGE_AUTO);
             break;
     }
 }
@@ -281,7 +528,8 @@ void KClmtr::setCalFileID(int calFileID) {
         loadedCalFile("");
     } else {
         string returnString;
-        //Goes to load cal file
+        //Goes to load cal file. Not batched, the index is a raw byte that is only
+        //safe to send once the device has answered D1 and is waiting for it
         if(sendMessageToKColorimeter(CALFILE_INCOMING, returnString) == 0) {
             if(returnString == "D1") {
                 string CalFile;
@@ -384,144 +632,446 @@ int KClmtr::getFFT_numberOfPeaks() const {
 }
 void KClmtr::threadStuff(void *args) {
     KClmtr *k = (KClmtr *)args;
-#ifdef WIN32
-    k->threadId = GetCurrentThreadId();
+    k->setChildMode(RUN);
+
+    k->beginStream();
+    while(k->parentMode() == RUN) {
+        if(k->measureMode != FLICKER && !k->m_measureInFlight) {
+            //Between frames is the only time the port is free. A pipelined N5 that is still coming back
+            //is read first, pipelineMeasurement() does not send another one while anything is queued
+            k->serviceCommandQueue();
+        }
+        Frame frame;
+        unsigned int error = k->readStreamFrame(frame);
+        if(error != KleinsErrorCodes::NONE && k->m_transport->isCancelled()) {
+            //Stopped while waiting, the reply is still on its way
+            k->m_measureInFlight = k->measureMode != FLICKER;
+            break;
+        }
+        k->handleStreamFrame(error, frame);
+    }
+    k->endThread();
+}
+#ifndef WIN32
+void *KClmtr::threadEntry(void *args) {
+    threadStuff(args);
+    return NULL;
+}
 #endif
-
-
-    k->threadModeChild = RUN;
-
-    if(k->measureMode == FLICKER) {
-        if(k->isFlickerNew()) {
-            k->m_flickerSettings.speed = 384;
-            k->sendMessageToKColorimeter(FLICKER_384PERSECOND);
-            sleep(5);
-            k->m_CommPort.setSetting(9600 * 2, 8, 'n', 10000);
+void KClmtr::beginStream() {
+    if(measureMode == FLICKER) {
+        if(isFlickerNew()) {
+            m_flickerSettings.speed = 384;
+            m_flickerStartAt = monotonicMicroseconds();
+            sendMessageToKColorimeter(FLICKER_384PERSECOND);
+            //T1 has to be all the way out at the old speed first
+            m_transport->drainOutput();
+            m_transport->setSetting(newFlickerBaudRate, 8, 'n', 10000);
         } else {
-            k->m_flickerSettings.speed = 256;
-            k->sendMessageToKColorimeter(FLICKER_256PERSECOND);
-        }
-    }
-    string FFTString;
-    while(k->threadModeParent == RUN) {
-        if(k->measureMode == MEASURE) {
-            string measure;
-            int error = k->sendMessageToKColorimeter(k->getColorMeasurmentCommand(), measure);
-            if(error == 0 && k->threadModeParent == RUN) {
-                k->m_measure = k->parseAndPrintXYZ(measure);
-
-                k->m_isMeasurefresh = true;
-                k->printMeasure(k->m_measure);
-            } else if(error) {
-                k->m_measure = Measurement::fromError(error);
-                k->threadModeParent = STOP;
-
-                k->m_isMeasurefresh = true;
-                k->printMeasure(k->m_measure);
-            }
-        } else if(k->measureMode == FLICKER) {
-            int error = 0;
-            if(error == 0 && FFTString.length() > 96) {
-                //Runs through FFT
-                if(!k->verify_FFTString(FFTString)) {
-                    //Make it pass the next time
-                    size_t nextT = FFTString.find('T', 1);
-                    if(nextT == FFTString.npos) {
-                        FFTString = "";
-                    } else {
-                        FFTString = FFTString.substr(nextT);
-                    }
-                } else {
-                    k->m_flicker = k->parseAndPrintFFT(FFTString);
-                    if(k->threadModeParent == RUN) {
-                        if(k->m_flicker.errorcode & ~((int)KleinsErrorCodes::FFT_PREVIOUS_RANGE | (int)KleinsErrorCodes::FFT_INSUFFICIENT_DATA | (int)KleinsErrorCodes::FFT_OVER_SATURATED)) {
-                            k->threadModeParent = STOP;
-                        }
-                        k->m_isFlickerfresh = true;
-                        k->printFlicker(k->m_flicker);
-                    }
-                }
-            } else {
-                //Reads more data to get above 96
-                error = k->readFromKColorimeter(96, 2, FFTString);
-                if(error != 0) {
-                    k->m_flicker = Flicker();
-                    k->m_flicker.errorcode = error;
-
-                    k->m_isFlickerfresh = true;
-                    k->threadModeParent = STOP;
-                    k->printFlicker(k->m_flicker);
+            m_flickerSettings.speed = 256;
+            m_flickerStartAt = monotonicMicroseconds();
+            sendMessageToKColorimeter(FLICKER_256PERSECOND);
+        }
+    }
+}
+unsigned int KClmtr::readStreamFrame(Frame &frame) {
+    if(measureMode == MEASURE) {
+        if(m_measurePipelined) {
+            return pipelineMeasurement(frame);
+        }
+        return sendMessageToKColorimeter(getColorMeasurmentCommand(), frame);
+    } else if(measureMode == FLICKER) {
+        //The decoder skips anything that is not a whole frame
+        return readFromKColorimeter(2, frame);
+    } else {
+        return sendMessageToKColorimeter(COUNTS_4PERSECOND, frame);
+    }
+}
+void KClmtr::handleStreamFrame(unsigned int error, const Frame &frame) {
+    if(measureMode == MEASURE) {
+        if(error == 0 && parentMode() == RUN) {
+            Measurement measure = parseAndPrintXYZ(frame.bytes);
+            stampFrame(measure, frame);
+            countMeasureFrame();
+
+            publishMeasure(measure);
+        } else if(error) {
+            setParentMode(STOP);
+
+            publishMeasure(Measurement::fromError(error));
+        }
+    } else if(measureMode == FLICKER) {
+        flickerWindow &window = m_flickerWindowOut;
+        if(error == 0) {
+            flickerFrameArrived(frame);
+            parseFlickerWindow(frame.bytes, window);
+            stampFrame(window, frame);
+            if(parentMode() == RUN) {
+                if(isFlickerStopError(window.errorcode)) {
+                    setParentMode(STOP);
                 }
+                //Runs through FFT
+                queueFlickerWindow(window);
             }
-        } else if(k->measureMode == COUNTS) {
-            string counts;
-            int error = k->sendMessageToKColorimeter(COUNTS_4PERSECOND, counts);
-            if(error == 0 && k->threadModeParent == RUN) {
-                k->m_counts = Counts(counts);
-
-                k->m_isCountsfresh = true;
-                k->printCounts(k->m_counts);
-            } else if(error) {
-                k->m_counts = Counts();
-                k->m_counts.errorcode = error;
-
-                k->threadModeParent = STOP;
-
-                k->m_isMeasurefresh = true;
-                k->printCounts(k->m_counts);
+        } else {
+            window.samples.clear();
+            window.errorcode = error;
+            window.timestamp = 0;
+            window.sequence = 0;
+
+            setParentMode(STOP);
+            queueFlickerWindow(window);
+        }
+    } else if(measureMode == COUNTS) {
+        if(error == 0 && parentMode() == RUN) {
+            Counts counts(frame.bytes);
+            stampFrame(counts, frame);
+
+            publishCounts(counts);
+        } else if(error) {
+            Counts counts;
+            counts.errorcode = error;
+
+            setParentMode(STOP);
+
+            publishCounts(counts);
+        }
+    }
+}
+void KClmtr::publishMeasure(const Measurement &m) {
+    lockThread();
+    m_measure = m;
+    m_isMeasurefresh = true;
+    signalThread();
+    unlockThread();
+    m_measureQueue.push(m);
+    m_callbackOut.measure = m;
+    queueCallback(MEASURE, m.getTimestamp());
+}
+void KClmtr::publishFlicker(const Flicker &f) {
+    //Three copies, each into a Flicker that is kept around, so the matrices are reused once they are the right size
+    lockThread();
+    m_flicker = f;
+    m_isFlickerfresh = true;
+    signalThread();
+    unlockThread();
+    m_flickerQueue.push(f);
+    m_callbackOut.flicker = f;
+    queueCallback(FLICKER, f.getTimestamp());
+}
+void KClmtr::publishCounts(const Counts &c) {
+    lockThread();
+    m_counts = c;
+    m_isCountsfresh = true;
+    signalThread();
+    unlockThread();
+    m_countsQueue.push(c);
+    m_callbackOut.counts = c;
+    queueCallback(COUNTS, c.getTimestamp());
+}
+bool KClmtr::setCallbackQueueSize(size_t frames) {
+    if(childMode() != NOT_RUNNING || isCallbackThread()) {
+        return false;
+    }
+    stopCallbackThread();
+    m_callbackQueue.setCapacity(frames);
+    lockCallbacks();
+    for(int i = 0; i < 3; ++i) {
+        m_callbackStats[i] = CallbackStats();
+    }
+    unlockCallbacks();
+    if(frames == 0) {
+        return true;
+    }
+    if(!startCallbackThread()) {
+        m_callbackQueue.setCapacity(0);
+        return false;
+    }
+    return true;
+}
+size_t KClmtr::getCallbackQueueSize() const {
+    return m_callbackQueue.capacity();
+}
+CallbackStats KClmtr::getMeasureCallbackStats() const {
+    lockCallbacks();
+    CallbackStats stats = m_callbackStats[MEASURE];
+    unlockCallbacks();
+    return stats;
+}
+CallbackStats KClmtr::getFlickerCallbackStats() const {
+    lockCallbacks();
+    CallbackStats stats = m_callbackStats[FLICKER];
+    unlockCallbacks();
+    return stats;
+}
+CallbackStats KClmtr::getCountsCallbackStats() const {
+    lockCallbacks();
+    CallbackStats stats = m_callbackStats[COUNTS];
+    unlockCallbacks();
+    return stats;
+}
+void KClmtr::queueCallback(int mode, long long readAt) {
+    m_callbackOut.mode = mode;
+    m_callbackOut.readAt = readAt;
+    if(m_callbackQueue.capacity() == 0) {
+        runCallback(m_callbackOut);
+        return;
+    }
+    bool queued = m_callbackQueue.push(m_callbackOut);
+    lockCallbacks();
+    if(queued) {
+        signalCallbacks();
+    } else {
+        ++m_callbackStats[mode].dropped;
+    }
+    unlockCallbacks();
+}
+void KClmtr::runCallback(const callbackFrame &frame) {
+    long long start = monotonicMicroseconds();
+    if(frame.mode == MEASURE) {
+        printMeasure(frame.measure);
+    } else if(frame.mode == FLICKER) {
+        printFlicker(frame.flicker);
+    } else {
+        printCounts(frame.counts);
+    }
+    long long end = monotonicMicroseconds();
+
+    lockCallbacks();
+    CallbackStats &stats = m_callbackStats[frame.mode];
+    ++stats.delivered;
+    stats.lastWait_us = frame.readAt > 0 ? (long)(start - frame.readAt) : 0;
+    stats.lastRun_us = (long)(end - start);
+    stats.maxWait_us = max(stats.maxWait_us, stats.lastWait_us);
+    stats.maxRun_us = max(stats.maxRun_us, stats.lastRun_us);
+    unlockCallbacks();
+}
+void KClmtr::callbackStuff(void *args) {
+    KClmtr *k = (KClmtr *)args;
+    k->lockCallbacks();
+#ifdef WIN32
+    k->m_callbackThreadId = GetCurrentThreadId();
+#else
+    k->m_callbackThreadId = pthread_self();
+#endif
+    for(;;) {
+        if(k->m_callbackQueue.size() != 0) {
+            //The stream can keep pushing while it is called
+            k->unlockCallbacks();
+            while(k->m_callbackQueue.pop(k->m_callbackIn)) {
+                k->runCallback(k->m_callbackIn);
             }
+            k->lockCallbacks();
+        } else if(k->m_callbackStopping) {
+            break;
+        } else {
+            k->waitCallbacks();
         }
     }
-    k->endThread();
+    k->m_callbackRunning = false;
+#ifdef WIN32
+    k->m_callbackThreadId = 0;
+#else
+    k->m_callbackThreadId = pthread_t();
+#endif
+    k->signalCallbacks();
+    k->unlockCallbacks();
+}
+#ifndef WIN32
+void *KClmtr::callbackEntry(void *args) {
+    callbackStuff(args);
+    return NULL;
+}
+#endif
+bool KClmtr::startCallbackThread() {
+    lockCallbacks();
+    m_callbackStopping = false;
+    m_callbackRunning = true;
+    unlockCallbacks();
+#ifdef WIN32
+    HANDLE thread = (HANDLE)_beginthread(KClmtr::callbackStuff, 0, this);
+    bool started = thread != 0 && thread != (HANDLE) - 1;
+#else
+    bool started = pthread_create(&m_callbackThread, NULL, KClmtr::callbackEntry, (void *)this) == 0;
+#endif
+    if(!started) {
+        lockCallbacks();
+        m_callbackRunning = false;
+        unlockCallbacks();
+    }
+    return started;
+}
+void KClmtr::stopCallbackThread() {
+    lockCallbacks();
+    if(!m_callbackRunning) {
+        unlockCallbacks();
+        return;
+    }
+    //Everything already queued is still called
+    m_callbackStopping = true;
+    signalCallbacks();
+    while(m_callbackRunning) {
+        waitCallbacks();
+    }
+    unlockCallbacks();
+#ifndef WIN32
+    pthread_join(m_callbackThread, NULL);
+#endif
+}
+bool KClmtr::isCallbackThread() const {
+    lockCallbacks();
+#ifdef WIN32
+    bool is = m_callbackRunning && m_callbackThreadId == GetCurrentThreadId();
+#else
+    bool is = m_callbackRunning && pthread_equal(m_callbackThreadId, pthread_self()) != 0;
+#endif
+    unlockCallbacks();
+    return is;
+}
+bool KClmtr::waitForFresh(const bool &fresh, long timeOut_ms) {
+    //Nothing new can come while the stream thread is waiting on itself
+    bool canWait = !isStreamThread();
+    long long deadline = monotonicMicroseconds() + (long long)timeOut_ms * 1000;
+    lockThread();
+    while(canWait && !fresh && threadModeChild != NOT_RUNNING && waitThreadUntil(deadline)) {
+    }
+    //Still locked, the caller takes the result and unlocks
+    return fresh;
+}
+void KClmtr::requestStreamFrame() {
+    long timeOut_Sec = 2;
+    if(measureMode != FLICKER) {
+        const command &m = measureMode == MEASURE ? getColorMeasurmentCommand() : COUNTS_4PERSECOND;
+        timeOut_Sec = m.timeout;
+        if(!m_measureInFlight) {
+            serviceCommandQueue();
+            drainCancelledReply();
+            m_transport->discardExisting();
+            m_decoder.expect(m.commandString, m.expected);
+            m_timeouts.begin(m.commandString, m.expected, m_transport->getSpeed());
+            writeToSerialPort(*m_transport, m.commandString);
+            m_measureInFlight = true;
+        }
+        m_streamDeadline = m_timeouts.deadline(timeOut_Sec);
+    } else {
+        //Same as readFromSerialPort()
+        m_streamDeadline = monotonicMicroseconds() + timeOut_Sec * 1500000LL;
+    }
+}
+void KClmtr::pollStream() {
+    long long start = monotonicMicroseconds();
+    m_transport->fill();
+    RingBuffer &received = m_transport->receiveBuffer();
+    while(parentMode() == RUN && !received.empty()) {
+        Frame frame;
+        received.consume(m_decoder.feed(received.view(received.size()), frame));
+        if(frame.type == Frame::NONE) {
+            continue;
+        }
+        frame.time = m_transport->getLastReadTime();
+        if(measureMode == FLICKER) {
+            setThroughput(frame.bytes.size, start);
+        } else if(measureMode == MEASURE && m_measurePipelined && !hasQueuedCommands()) {
+            //The next one goes out before this one is parsed, the decoder keeps this one until the next feed
+            const command &m = getColorMeasurmentCommand();
+            m_timeouts.finish();
+            m_timeouts.begin(m.commandString, m.expected, m_transport->getSpeed());
+            writeToSerialPort(*m_transport, m.commandString);
+        } else {
+            m_timeouts.finish();
+            m_measureInFlight = false;
+        }
+        handleStreamFrame(KleinsErrorCodes::NONE, frame);
+        if(parentMode() == RUN) {
+            requestStreamFrame();
+        }
+    }
+    if(parentMode() == RUN && !m_transport->isOpen()) {
+        handleStreamFrame(KleinsErrorCodes::LOST_CONNECTION, Frame());
+    }
+}
+void KClmtr::checkStreamDeadline(long long now) {
+    if(parentMode() == RUN && now >= m_streamDeadline) {
+        m_measureInFlight = false;
+        handleStreamFrame(KleinsErrorCodes::TIMED_OUT, Frame());
+    }
 }
 void KClmtr::endThread() {
     if(measureMode == FLICKER) {
         endFlicker();
+    } else if(m_measureInFlight) {
+        //The last command is still coming back, it can't be left for the next command to find.
+        //Waiting for it here would hold up the stop, so the next command waits for it
+        m_drainUntil = m_timeouts.deadline((measureMode == MEASURE ? getColorMeasurmentCommand() : COUNTS_4PERSECOND).timeout);
+        m_measureInFlight = false;
     }
-    threadModeChild = NOT_RUNNING;
-    threadId = 0;
+    //Last thing, the parent can go on as soon as it sees this
+    setChildMode(NOT_RUNNING);
 }
 void KClmtr::stopThread2() {
-    if(threadModeChild == NOT_RUNNING) {
+    if(childMode() == NOT_RUNNING) {
+        //It could have stopped on its own, like after an error
+        joinStreamThread();
+        waitForFlickerAnalysis();
         return;
     }
-    threadModeParent = STOP;
-    //Making sure the thread has ended
-#ifdef WIN32
-    DWORD currentThreadID = GetCurrentThreadId();
-    if(threadId != currentThreadID) {
-#else
-    pthread_t currentThreadID = pthread_self();
-    if(threadId != currentThreadID) {
-#endif
-        while(threadModeChild != NOT_RUNNING) {
-            sleep(1);
+    setParentMode(STOP);
+    long long start = monotonicMicroseconds();
+    if(m_streamReactor != NULL) {
+        if(isStreamThread()) {
+            //From a callback, it has to be gone before it can be started again
+            if(m_streamReactor->isAttached(this)) {
+                m_streamReactor->finish(this);
+            }
+        } else {
+            m_streamReactor->wake();
+            waitForChildStop();
         }
-#ifdef WIN32
-        WaitForSingleObject(threadH, INFINITE);
-#else
-        pthread_join(threadId, NULL);
-#endif
+        m_streamReactor = NULL;
+        waitForFlickerAnalysis();
+        setParentMode(NOT_RUNNING);
+        m_lastStopWait = (long)(monotonicMicroseconds() - start);
+        return;
     }
-     threadModeParent = NOT_RUNNING;
+    //Making sure the thread has ended
+    if(!isStreamThread()) {
+        //Wakes the thread if it is waiting on a reply
+        m_transport->cancel();
+        waitForChildStop();
+        joinStreamThread();
+        m_transport->clearCancel();
+        //The stream was woken up before it could wait for the port to go quiet
+        finishFlickerStop();
+    }
+    waitForFlickerAnalysis();
+    setParentMode(NOT_RUNNING);
+    m_lastStopWait = (long)(monotonicMicroseconds() - start);
 }
 void KClmtr::startThread2(_measureMode m) {
     stopThread2();
-    threadId = 0;
     measureMode = m;
+    lockThread();
     threadModeParent = RUN;
     threadModeChild = NOT_RUNNING;
+    unsigned long starts = m_childStarts;
+    unlockThread();
+    m_frameSequence = 0;
+    m_streamReactor = m_reactor;
+    if(m_streamReactor != NULL) {
+        if(m_streamReactor->attach(*this)) {
+            return;
+        }
+        m_streamReactor = NULL;
+    }
 #ifdef WIN32
     threadH = (HANDLE)_beginthread(KClmtr::threadStuff, 0, this);
-    if(threadH == 0) {
+    if(threadH == 0 || threadH == (HANDLE)-1) {
 #else
-    int stacksize = 0;
-    pthread_attr_t  attr;
-    pthread_attr_init(&attr);
-    pthread_attr_setstacksize(&attr, stacksize);
-    pthread_create(&threadId, &attr, (void * ( *)(void *))KClmtr::threadStuff, (void *)this);
-    if(threadId == 0) {
+    m_streamJoinable = pthread_create(&m_streamThread, NULL, KClmtr::threadEntry, (void *)this) == 0;
+    if(!m_streamJoinable) {
 #endif
+        //There is nothing to wait for
+        setParentMode(NOT_RUNNING);
         if(isMeasuring()) {
             stopMeasuring();
         }
@@ -531,10 +1081,14 @@ void KClmtr::startThread2(_measureMode m) {
         if(isMeasureCounts()) {
             stopMeasureCounts();
         }
+        return;
     }
-    while(threadModeChild == NOT_RUNNING) {
-        sleep(1);
+    //Until the thread has it going, it may already be done with it
+    lockThread();
+    while(m_childStarts == starts) {
+        waitThread();
     }
+    unlockThread();
 }
 void KClmtr::stopFlicker2() {
     stopThread2();
@@ -578,6 +1132,144 @@ void KClmtr::setMeasureSpeedMode(SpeedMode value) {
     }
     m_speedMode = value;
 }
+bool KClmtr::getMeasurePipelined() const {
+    return m_measurePipelined;
+}
+void KClmtr::setMeasurePipelined(bool pipelined) {
+    if(isMeasuring()) {
+        stopMeasuring();
+    }
+    m_measurePipelined = pipelined;
+}
+void KClmtr::setTimeoutSafetyFactor(double factor) {
+    m_timeouts.setSafetyFactor(factor);
+}
+double KClmtr::getTimeoutSafetyFactor() const {
+    return m_timeouts.getSafetyFactor();
+}
+long long KClmtr::getLastTimeout() const {
+    return m_timeouts.getLastTimeout();
+}
+long long KClmtr::getRoundTrip(const string &commandString) const {
+    return m_timeouts.getRoundTrip(commandString);
+}
+void KClmtr::setLowLatency(bool lowLatency) {
+    m_CommPort.setLowLatency(lowLatency);
+}
+bool KClmtr::getLowLatency() const {
+    return m_CommPort.getLowLatency();
+}
+void KClmtr::setReactor(KClmtrReactor *reactor) {
+    m_reactor = reactor;
+}
+KClmtrReactor *KClmtr::getReactor() const {
+    return m_reactor;
+}
+double KClmtr::getMeasureFrameRate() const {
+    lockThread();
+    unsigned long frames = m_measureFrames;
+    long long first = m_firstMeasureTime;
+    long long last = m_lastMeasureTime;
+    unlockThread();
+    if(frames < 2 || last <= first) {
+        return 0;
+    }
+    return (frames - 1) * 1000000.0 / (last - first);
+}
+long KClmtr::getOverruns() {
+    long overruns = m_transport->getOverruns();
+    if(overruns < 0) {
+        return -1;
+    }
+    lockThread();
+    long base = m_overrunBase;
+    unlockThread();
+    return overruns - base;
+}
+unsigned long long KClmtr::getBytesDiscarded() const {
+    //The decoder's count is atomic, the base is changed under the lock
+    unsigned long long discarded = m_decoder.discarded();
+    lockThread();
+    unsigned long long base = m_discardedBase;
+    unlockThread();
+    return discarded > base ? discarded - base : 0;
+}
+unsigned long KClmtr::getFramesDelivered() const {
+    lockThread();
+    unsigned long delivered = m_framesDelivered;
+    unlockThread();
+    return delivered;
+}
+unsigned long KClmtr::getFramesDropped() const {
+    lockThread();
+    unsigned long dropped = m_framesDropped;
+    unlockThread();
+    return dropped;
+}
+void KClmtr::resetStreamCounters() {
+    long overruns = m_transport->getOverruns();
+    unsigned long long discarded = m_decoder.discarded();
+    lockThread();
+    m_overrunBase = overruns < 0 ? 0 : overruns;
+    m_discardedBase = discarded;
+    m_discardedSeen = discarded;
+    m_framesDelivered = 0;
+    m_framesDropped = 0;
+    unlockThread();
+}
+void KClmtr::countFrame(const Frame &frame) {
+    unsigned long long discarded = m_decoder.discarded();
+    lockThread();
+    ++m_framesDelivered;
+    if(discarded > m_discardedSeen && frame.bytes.size > 0) {
+        //What was thrown away since the last good frame was at least one frame
+        unsigned long long lost = discarded - m_discardedSeen;
+        m_framesDropped += (unsigned long)((lost + frame.bytes.size - 1) / frame.bytes.size);
+    }
+    m_discardedSeen = discarded;
+    unlockThread();
+}
+void KClmtr::countMeasureFrame() {
+    long long now = monotonicMicroseconds();
+    lockThread();
+    m_lastMeasureTime = now;
+    if(m_measureFrames == 0) {
+        m_firstMeasureTime = now;
+    }
+    ++m_measureFrames;
+    unlockThread();
+}
+unsigned int KClmtr::pipelineMeasurement(Frame &reply) {
+    const command &m = getColorMeasurmentCommand();
+    reply = Frame();
+    if(!m_transport->isOpen()) {
+        m_measureInFlight = false;
+        return KleinsErrorCodes::NOT_OPEN;
+    }
+    if(!m_measureInFlight) {
+        //Priming the pipe with the first command
+        drainCancelledReply();
+        m_transport->discardExisting();
+        m_decoder.expect(m.commandString, m.expected);
+        m_timeouts.begin(m.commandString, m.expected, m_transport->getSpeed());
+        writeToSerialPort(*m_transport, m.commandString);
+        m_measureInFlight = true;
+    }
+    unsigned int error = readFromSerialPort(*m_transport, m_decoder, m.timeout, reply, &m_timeouts);
+    if(error != KleinsErrorCodes::NONE) {
+        m_measureInFlight = false;
+        return error;
+    }
+    //The next one goes out before this one is parsed, the device is never left waiting on us.
+    //The decoder keeps the reply we have until the next read
+    if(parentMode() == RUN && !hasQueuedCommands()) {
+        m_timeouts.begin(m.commandString, m.expected, m_transport->getSpeed());
+        writeToSerialPort(*m_transport, m.commandString);
+    } else {
+        m_measureInFlight = false;
+    }
+    return error;
+}
 const KClmtr::command &KClmtr::getColorMeasurmentCommand() const {
     switch(m_speedMode) {
         case SpeedMode::SPEEDMODE_SLOWEST:
@@ -595,6 +1287,9 @@ void KClmtr::startMeasuring() {
     stopFlicker();
     stopMeasureCounts();
     m_MeasuringN5 = true;
+    lockThread();
+    m_measureFrames = 0;
+    unlockThread();
     m_AvgLast = 0;
     m_AvgX = new double[m_MaxAvgNumber];
     m_AvgY = new double[m_MaxAvgNumber];
@@ -617,10 +1312,46 @@ void KClmtr::stopMeasuring() {
 bool KClmtr::isMeasuring() const {
     return m_MeasuringN5;
 }
+size_t KClmtr::drainMeasurements(vector<Measurement> &out) {
+    size_t n = 0;
+    Measurement m;
+    while(m_measureQueue.pop(m)) {
+        out.push_back(m);
+        ++n;
+    }
+    return n;
+}
+bool KClmtr::popMeasurement(Measurement &m) {
+    return m_measureQueue.pop(m);
+}
+bool KClmtr::setStreamQueueSize(size_t frames) {
+    if(childMode() != NOT_RUNNING) {
+        return false;
+    }
+    m_measureQueue.setCapacity(frames);
+    m_flickerQueue.setCapacity(frames);
+    m_countsQueue.setCapacity(frames);
+    return true;
+}
+size_t KClmtr::getStreamQueueSize() const {
+    return m_measureQueue.capacity();
+}
+size_t KClmtr::getStreamQueueOverflows() const {
+    return m_measureQueue.overflows() + m_flickerQueue.overflows() + m_countsQueue.overflows();
+}
 bool KClmtr::getMeasurement(Measurement &m) {
+    lockThread();
     m = m_measure;
     bool temp = m_isMeasurefresh;
     m_isMeasurefresh = false;
+    unlockThread();
+    return temp;
+}
+bool KClmtr::waitForMeasurement(Measurement &m, long timeOut_ms) {
+    bool temp = waitForFresh(m_isMeasurefresh, timeOut_ms);
+    m = m_measure;
+    m_isMeasurefresh = false;
+    unlockThread();
     return temp;
 }
 void KClmtr::correctXYZCalFile(double inX, double inY, double inZ, double &outX, double &outY, double &outZ) {
@@ -657,13 +1388,15 @@ Measurement KClmtr::getNextMeasurement(int n) {
     m_AvgZ = new double[m_MaxAvgNumber];
 
     int i = 0;
+    m_frameSequence = 0;
     do {
-        string mstring;
+        Frame mstring;
         error = sendMessageToKColorimeter(getColorMeasurmentCommand(), mstring);
         if(error != KleinsErrorCodes::NONE) {
             return Measurement::fromError(error);
         }
-        m = parseAndPrintXYZ(mstring, n < 1);
+        m = parseAndPrintXYZ(mstring.bytes, n < 1);
+        stampFrame(m, mstring);
 
         ++i;
     } while(
@@ -810,33 +1543,26 @@ int KClmtr::boxCarAvg(double(&data)[3], double(&minMax)[3][2], bool autoAvg, int
     return avgNumber;
 }
 
-Measurement KClmtr::parseAndPrintXYZ(string ReadString, bool autoAvg) {
-    string SubString;
-    string MyError;
+Measurement KClmtr::parseAndPrintXYZ(const ByteView &ReadString, bool autoAvg) {
     int error = 0;
     double data[3];
     //ReadString = "" + (char)78 + (char)53 + (char)93 + (char)90 + (char)7 + (char)102 + (char)173 + (char)7 + (char)77 + (char)42 + (char)7 + (char)128 + (char)60 + (char)48 + (char)62;
 
     //Getting X
-    SubString = ReadString.substr(2, 3);
-    data[0] = parseK_float(SubString);
+    data[0] = parseK_float(ReadString.data + 2);
 
     //Getting Big Y OR L
-    SubString = ReadString.substr(5, 3);
-    data[1] = parseK_float(SubString);
+    data[1] = parseK_float(ReadString.data + 5);
 
     //Getting Z
-    SubString = ReadString.substr(8, 3);
-    data[2] = parseK_float(SubString);
+    data[2] = parseK_float(ReadString.data + 8);
 
     //Getting(range)
-    SubString = ReadString.substr(11, 1);
     int ranges[3];
-    parsingRange(SubString.c_str()[0], ranges);
+    parsingRange(ReadString[11], ranges);
 
     //Getting error
-    MyError = ReadString.substr(13, 1);
-    error = KleinsErrorCodes::getErrorCodeFromKlein(MyError);
+    error = KleinsErrorCodes::getErrorCodeFromKlein(string(1, (char)ReadString[13]));
 
     //Run the Avg
     double minMax[3][2];
@@ -935,11 +1661,10 @@ double KClmtr::unpackK_float(string PartString) {
     K_float = K_float * exp(chr3 * log(2.0));
     return K_float;
 }
-double KClmtr::parseK_float(string MyString) {
+double KClmtr::parseK_float(const unsigned char *myRead) {
     //this is an XYZ response K_float, may be 2x different from matrix K_float
     int MyInt1, MyInt2, MyInt3, NegFlag;
     double MyFraction, K_float;
-    const unsigned char *myRead = (const unsigned char *)MyString.c_str();
     //MyString is 3 chrs.. sign bit, 15 bit fraction, and 1 byte 2's exponent in 2's complement format
     MyInt1 = (int)myRead[0];
     MyInt2 = (int)myRead[1];
@@ -1456,7 +2181,7 @@ int KClmtr::deleteCalFile(int calFileID) {
         }
 
         //Saving CalFile
-        error = sendMessageToSerialPort(m_CommPort, emptyCalFile, 3, 5, returnString);
+        error = sendMessageToSerialPort(*m_transport, m_decoder, emptyCalFile, 3, 5, returnString, &m_timeouts);
         if(error != KleinsErrorCodes::NONE) {
             return error;
         }
@@ -1464,7 +2189,7 @@ int KClmtr::deleteCalFile(int calFileID) {
             return KleinsErrorCodes::CAL_STORING;
         }
         //Get all the CalFiles on device
-        error = sendMessageToKColorimeter(CALFILE_FILELIST, returnString);
+        error = fetchAndCache(CALFILE_FILELIST, returnString);
         if(error != KleinsErrorCodes::NONE) {
             return error;
         }
@@ -1525,7 +2250,7 @@ int KClmtr::storeMatrices(int id, const string &name, const CorrectedCoefficient
         }
         //Adding the Password
         CalFile = appendMatrixPassword(id, CalFile);
-        error = sendMessageToSerialPort(m_CommPort, CalFile, 3, 5, returnString);
+        error = sendMessageToSerialPort(*m_transport, m_decoder, CalFile, 3, 5, returnString, &m_timeouts);
         if(error != KleinsErrorCodes::NONE) {
             return error;
         }
@@ -1533,7 +2258,7 @@ int KClmtr::storeMatrices(int id, const string &name, const CorrectedCoefficient
             return KleinsErrorCodes::CAL_STORING;
         }
         //Get all the CalFiles on device
-        error = sendMessageToKColorimeter(CALFILE_FILELIST, returnString);
+        error = fetchAndCache(CALFILE_FILELIST, returnString);
         if(error != KleinsErrorCodes::NONE) {
             return error;
         }
@@ -1800,22 +2525,22 @@ int KClmtr::startFlicker(bool grabConstantly) {
         startFlicker2();
         return KleinsErrorCodes::NONE;
     } else {
+        m_flickerStartAt = monotonicMicroseconds();
         if(isFlickerNew()) {
             m_flickerSettings.speed = 384;
             error = sendMessageToKColorimeter(FLICKER_384PERSECOND);
             if(error != KleinsErrorCodes::NONE) {
                 return error;
             }
-            m_CommPort.setSetting(9600 * 2, 8, 'n', 10000);
+            //T1 has to be all the way out at the old speed first
+            m_transport->drainOutput();
+            m_transport->setSetting(newFlickerBaudRate, 8, 'n', 10000);
         } else {
             m_flickerSettings.speed = 256;
             error = sendMessageToKColorimeter(FLICKER_256PERSECOND);
         }
-        if(error != KleinsErrorCodes::NONE) {
-            return error;
-        }
-        sleep(10);
-        return KleinsErrorCodes::NONE;
+        //The first read waits for the stream to start, the decoder skips anything before the first whole frame
+        return error;
     }
 }
 unsigned int KClmtr::printStartupString(const string &read) {
@@ -1950,10 +2675,31 @@ unsigned int KClmtr::checkThreeFFT_Validity(double array[][129]) {
 
     return KleinsErrorCodes::NONE;
 }
+size_t KClmtr::drainFlickers(vector<Flicker> &out) {
+    size_t n = 0;
+    Flicker f;
+    while(m_flickerQueue.pop(f)) {
+        out.push_back(f);
+        ++n;
+    }
+    return n;
+}
+bool KClmtr::popFlicker(Flicker &f) {
+    return m_flickerQueue.pop(f);
+}
 bool KClmtr::getFlicker(Flicker &f) {
+    lockThread();
     f = m_flicker;
     bool temp = m_isFlickerfresh;
     m_isFlickerfresh = false;
+    unlockThread();
+    return temp;
+}
+bool KClmtr::waitForFlicker(Flicker &f, long timeOut_ms) {
+    bool temp = waitForFresh(m_isFlickerfresh, timeOut_ms);
+    f = m_flicker;
+    m_isFlickerfresh = false;
+    unlockThread();
     return temp;
 }
 
@@ -1964,43 +2710,21 @@ Flicker KClmtr::getNextFlicker() {
     if(m_Flickering) {
         stopFlicker();
     }
-    Flicker flicker;
+    flickerWindow window;
     if(startFlicker(false) == KleinsErrorCodes::NONE &&
        m_Flickering) {
-
-        string readString = "";
-        m_CommPort.readExisting();
-        unsigned int error = readFromKColorimeter(96 * (m_fft_numPass) + 2, 2 * (m_fft_numPass), readString);
-        if(error != KleinsErrorCodes::NONE) {
-            return Flicker(error);
-        }
-        //byte[] ByteARray = {84, 128, 163, 50, 95, 131, 82, 79, 51, 159, 86, 115, 11, 107, 163, 124, 130, 115, 66, 147, 3, 9, 154, 163, 184, 143, 115, 36, 112, 131, 3, 84, 211, 73, 80, 19, 60, 95, 115, 48, 118, 195, 62, 139, 51, 95, 151, 227, 95, 152, 99, 95, 130, 195, 95, 97, 99, 95, 79, 131, 95, 85, 99, 95, 106, 19, 95, 129, 3, 95, 146, 35, 95, 154, 147, 95, 145, 4, 95, 115, 4, 95, 86, 20, 95, 79, 164, 95, 93, 244, 95, 117, 36, 95, 138, 4, 84, 151, 84, 50, 153, 4, 81, 132, 196, 237, 99, 100, 11, 79, 244, 123, 84, 116, 136, 104, 132, 9, 127, 164, 185, 145, 68, 148, 154, 100, 3, 146, 84, 73, 117, 68, 60, 87, 100, 48, 79, 84, 62, 92, 148, 95, 115, 132, 95, 136, 212, 95, 150, 180, 95, 153, 132, 95, 134, 196, 95, 101, 100, 95, 80, 116, 95, 83, 132, 95, 102, 244, 95, 126, 68, 95, 144, 100, 95, 154, 36, 95, 147, 164, 95, 119, 164, 95, 88, 212, 95, 79, 20, 95, 91, 84};
-        size_t x = readString.length() - 96;
-        for(; x > 0; --x) {
-            if(readString[x] == 'T' && readString[x + 3] == '2' && readString[x + 42] == '>'
-                    && readString[x + 45] == '_' && readString[x + 48] == '_'
-                    && readString[x + 51] == '_' && readString[x + 93] == '_') {
-                break;
-            }
-        }
-        string correctString = "";
-        if(x > 0) {
-            readString.erase(0, x % 3);
-            x -= x % 3;
-            //Coping all the makers and the samples
-            for(int i = 0; i < 96 * (m_fft_numPass); ++i) {
-                if((i % 3) == 0) {
-                    correctString += readString[(i % 96) + x];
-                } else {
-                    correctString += readString[i];
-                }
+        //Anything that was on its way before the first whole frame gets skipped by the decoder
+        m_frameSequence = 0;
+        while(m_fft_numPass > 0) {
+            Frame FFTFrame;
+            unsigned int error = readFromKColorimeter(2, FFTFrame);
+            if(error != KleinsErrorCodes::NONE) {
+                return Flicker(error);
             }
-        }
-
-        if(correctString.length() >= 96U * (m_fft_numPass)) {
-            flicker = parseAndPrintFFT(correctString);
-        } else {
-            return Flicker(KleinsErrorCodes::FFT_BAD_STRING);
+            flickerFrameArrived(FFTFrame);
+            //Only the last one is returned, so it is the only one that needs the FFT
+            parseFlickerWindow(FFTFrame.bytes, window);
+            stampFrame(window, FFTFrame);
         }
 
         m_Flickering2 = false;
@@ -2012,7 +2736,7 @@ Flicker KClmtr::getNextFlicker() {
     //Stopping Flicker with a command
     endFlicker();
 
-    return flicker;
+    return analyzeFlickerWindow(window);
 }
 void KClmtr::setDeviceFlickerSpeed(bool use) {
     m_DeviceFlickerSpeed = use;
@@ -2029,39 +2753,92 @@ bool KClmtr::isFlickerNew() {
 	}
 }
 void KClmtr::endFlicker() {
+    m_flickerStopAt = monotonicMicroseconds();
+    int streamSpeed = m_transport->getSpeed();
     //Stopping Flicker with a command
     sendMessageToKColorimeter(DUMMY);
     sendMessageToKColorimeter(DUMMY);
+    //The old firmware needs one more, but only once it has stopped sending
+    m_flickerLastX9 = !isFlickerNew();
+    //X9 has to be all the way out before the speed changes, and before the quiet can be timed
+    m_transport->drainOutput();
     if(isFlickerNew()) {
-        sleep(5);
-        m_CommPort.setSetting(9600, 8, 'n', 10000);
-    } else {
-        sleep(10);
-        sendMessageToKColorimeter(DUMMY);
+        m_transport->setSetting(m_baudRate, 8, 'n', 10000);
     }
-    sleep(10);
-    m_CommPort.readExisting();
+    m_flickerQuiet_us = flickerQuietTime(streamSpeed);
+    if(!m_transport->isCancelled()) {
+        finishFlickerStop();
+    }
+    //Otherwise stopThread2() finishes it once the port is not cancelled
     resetFlicker();
 }
+void KClmtr::finishFlickerStop() {
+    if(m_flickerStopAt == 0) {
+        return;
+    }
+    //The frame the device was sending when X9 got there still comes in
+    if(!m_transport->waitQuiet(m_flickerQuiet_us, flickerQuietLimit) && m_transport->isCancelled()) {
+        return;
+    }
+    if(m_flickerLastX9) {
+        sendMessageToKColorimeter(DUMMY);
+        m_transport->drainOutput();
+        m_flickerLastX9 = false;
+    }
+    m_transport->discardExisting();
+    m_lastFlickerStop = (long)(monotonicMicroseconds() - m_flickerStopAt);
+    m_flickerStopAt = 0;
+    printFlickerSwitch(false, m_lastFlickerStop);
+}
+long KClmtr::flickerQuietTime(int speed) const {
+    if(speed <= 0) {
+        speed = defaultBaudRate;
+    }
+    //A gap this long can't be inside a frame
+    long quiet = flickerQuietBytes * 10 * 1000000L / speed;
+    if(m_transport == &m_CommPort) {
+        //The USB adapter can hold on to the last bytes for its latency timer
+        int timer = m_CommPort.getLatencyTimer();
+        quiet += timer >= 0 ? timer * 1000L : unknownLatency_us;
+    }
+    return quiet;
+}
+void KClmtr::flickerFrameArrived(const Frame &frame) {
+    if(m_flickerStartAt == 0) {
+        return;
+    }
+    m_lastFlickerStart = (long)(frame.time - m_flickerStartAt);
+    m_flickerStartAt = 0;
+    printFlickerSwitch(true, m_lastFlickerStart);
+}
+long KClmtr::getLastFlickerStart() const {
+    return m_lastFlickerStart;
+}
+long KClmtr::getLastFlickerStop() const {
+    return m_lastFlickerStop;
+}
 
 void KClmtr::stopFlicker() {
-    if(threadModeChild == NOT_RUNNING) {
+    if(childMode() == NOT_RUNNING) {
         resetFlicker();
     } else {
         stopFlicker2();
     }
 }
 //FFT - Parsing
-Flicker KClmtr::parseAndPrintFFT(string &read) {
-    if(!verify_FFTString(read)) {
-        return Flicker(KleinsErrorCodes::FFT_BAD_STRING);
+void KClmtr::parseFlickerWindow(const ByteView &read, flickerWindow &window) {
+    //The markers were checked by the decoder
+    if(read.size < 96) {
+        window.samples.clear();
+        window.errorcode = KleinsErrorCodes::FFT_BAD_STRING;
+        return;
     }
 
     //shifts gsinRippleArray() by 32 values, parses and appends
     unsigned int error = parseSignal_from_FFT_str(read);
 
     //error byte is in gintErrorByte, but just might mess up if multiple colorimeters, so get error byte directly:
-    unsigned char ErrorByte = (unsigned char)read[39];
+    unsigned char ErrorByte = read[39];
 
     if((ErrorByte != '0') && (ErrorByte != 'L')) {
         m_fft_lastRange = 100;
@@ -2093,44 +2870,185 @@ Flicker KClmtr::parseAndPrintFFT(string &read) {
     }
     ++m_fft_count;
 
-    Flicker theFlicker(m_flickerSettings, m_ParsedOutRippleArray, m_fft_count, y);
-    theFlicker.bigY = y;
-    theFlicker.range = range;
+    window.settings = m_flickerSettings;
+    window.samples.assign(m_ParsedOutRippleArray, m_ParsedOutRippleArray + m_flickerSettings.samples);
+    window.count = m_fft_count;
+    window.bigY = y;
+    window.range = range;
 
     --m_fft_numPass;
     if(m_fft_numPass > 0) {
         error |= KleinsErrorCodes::FFT_INSUFFICIENT_DATA;
-        if(m_Flickering2) {
-            read = read.substr(96, (int)read.length() - 96);
-            theFlicker.errorcode = error;
-            return parseAndPrintFFT(read);
-        }
     } else {
         error &= ~KleinsErrorCodes::FFT_INSUFFICIENT_DATA;
     }
-    read = read.substr(96, (int)read.length() - 96);
 
-    theFlicker.errorcode = error;
+    window.errorcode = error;
+}
+Flicker KClmtr::analyzeFlickerWindow(const flickerWindow &window) {
+    if(window.samples.empty()) {
+        Flicker theFlicker(window.errorcode);
+        theFlicker.timestamp = window.timestamp;
+        theFlicker.sequence = window.sequence;
+        return theFlicker;
+    }
+    Flicker theFlicker(window.settings, &window.samples[0], window.count, window.bigY);
+    theFlicker.bigY = window.bigY;
+    theFlicker.range = window.range;
+    theFlicker.errorcode = window.errorcode;
+    theFlicker.timestamp = window.timestamp;
+    theFlicker.sequence = window.sequence;
     return theFlicker;
-
-
 }
-bool KClmtr::verify_FFTString(const string &FFTString) {
-    if(FFTString[0] != 'T' ||
-            FFTString[3] != '2' ||
-            FFTString[42] != '>') {
+bool KClmtr::isFlickerStopError(unsigned int error) {
+    return (error & ~((int)KleinsErrorCodes::FFT_PREVIOUS_RANGE | (int)KleinsErrorCodes::FFT_INSUFFICIENT_DATA | (int)KleinsErrorCodes::FFT_OVER_SATURATED)) != 0;
+}
+bool KClmtr::setFlickerAnalysisThread(bool on, bool skipStale) {
+    if(childMode() != NOT_RUNNING || isAnalysisThread()) {
         return false;
     }
-    for(int j = 45; j < 96; j += 3) {
-        if(FFTString[j] != '_') {
-            return false;
-        }
+    stopAnalysisThread();
+    lockThread();
+    m_skipStaleWindows = skipStale;
+    m_flickerWindowsSkipped = 0;
+    unlockThread();
+    if(!on) {
+        m_flickerWindows.setCapacity(0);
+        return true;
+    }
+    m_flickerWindows.setCapacity(flickerWindowQueue);
+    if(!startAnalysisThread()) {
+        m_flickerWindows.setCapacity(0);
+        return false;
     }
-
     return true;
 }
-unsigned int KClmtr::parseSignal_from_FFT_str(const string &FFTString) {
-    const unsigned char *ByteArray = (const unsigned char *)FFTString.c_str();;
+bool KClmtr::getFlickerAnalysisThread() const {
+    return m_flickerWindows.capacity() != 0;
+}
+unsigned long KClmtr::getFlickerWindowsSkipped() const {
+    lockThread();
+    unsigned long skipped = m_flickerWindowsSkipped;
+    unlockThread();
+    return skipped + (unsigned long)m_flickerWindows.overflows();
+}
+void KClmtr::queueFlickerWindow(const flickerWindow &window) {
+    if(m_flickerWindows.capacity() == 0) {
+        publishFlicker(analyzeFlickerWindow(window));
+        return;
+    }
+    if(m_flickerWindows.push(window)) {
+        lockThread();
+        signalThread();
+        unlockThread();
+    }
+}
+void KClmtr::analysisStuff(void *args) {
+    KClmtr *k = (KClmtr *)args;
+    k->lockThread();
+#ifdef WIN32
+    k->m_analysisThreadId = GetCurrentThreadId();
+#else
+    k->m_analysisThreadId = pthread_self();
+#endif
+    for(;;) {
+        if(k->m_flickerWindows.size() != 0) {
+            k->m_analysisBusy = true;
+            bool skipStale = k->m_skipStaleWindows;
+            k->unlockThread();
+
+            flickerWindow &window = k->m_flickerWindowIn;
+            unsigned long skipped = 0;
+            k->m_flickerWindows.pop(window);
+            //A newer one has all of the samples of this one, unless this one ended the stream
+            while(skipStale && !isFlickerStopError(window.errorcode) && k->m_flickerWindows.pop(window)) {
+                ++skipped;
+            }
+            k->publishFlicker(analyzeFlickerWindow(window));
+
+            k->lockThread();
+            k->m_flickerWindowsSkipped += skipped;
+            k->m_analysisBusy = false;
+            k->signalThread();
+        } else if(k->m_analysisStopping) {
+            break;
+        } else {
+            k->waitThread();
+        }
+    }
+    k->m_analysisRunning = false;
+#ifdef WIN32
+    k->m_analysisThreadId = 0;
+#else
+    k->m_analysisThreadId = pthread_t();
+#endif
+    k->signalThread();
+    k->unlockThread();
+}
+#ifndef WIN32
+void *KClmtr::analysisEntry(void *args) {
+    analysisStuff(args);
+    return NULL;
+}
+#endif
+bool KClmtr::startAnalysisThread() {
+    lockThread();
+    m_analysisStopping = false;
+    m_analysisRunning = true;
+    unlockThread();
+#ifdef WIN32
+    HANDLE thread = (HANDLE)_beginthread(KClmtr::analysisStuff, 0, this);
+    bool started = thread != 0 && thread != (HANDLE) - 1;
+#else
+    bool started = pthread_create(&m_analysisThread, NULL, KClmtr::analysisEntry, (void *)this) == 0;
+#endif
+    if(!started) {
+        lockThread();
+        m_analysisRunning = false;
+        unlockThread();
+    }
+    return started;
+}
+void KClmtr::stopAnalysisThread() {
+    lockThread();
+    if(!m_analysisRunning) {
+        unlockThread();
+        return;
+    }
+    m_analysisStopping = true;
+    signalThread();
+    while(m_analysisRunning) {
+        waitThread();
+    }
+    unlockThread();
+#ifndef WIN32
+    pthread_join(m_analysisThread, NULL);
+#endif
+}
+bool KClmtr::isAnalysisThread() const {
+    lockThread();
+#ifdef WIN32
+    bool is = m_analysisRunning && m_analysisThreadId == GetCurrentThreadId();
+#else
+    bool is = m_analysisRunning && pthread_equal(m_analysisThreadId, pthread_self()) != 0;
+#endif
+    unlockThread();
+    return is;
+}
+void KClmtr::waitForFlickerAnalysis() {
+    //From printFlicker() it is the one being waited on
+    if(isAnalysisThread()) {
+        return;
+    }
+    lockThread();
+    while(m_analysisRunning && (m_analysisBusy || m_flickerWindows.size() != 0)) {
+        waitThread();
+    }
+    unlockThread();
+}
+
+unsigned int KClmtr::parseSignal_from_FFT_str(const ByteView &FFTString) {
+    const unsigned char *ByteArray = FFTString.data;
 
     //256
     for(int i = 0; i < (m_flickerSettings.samples - 32); ++i) {
@@ -2149,39 +3067,39 @@ unsigned int KClmtr::parseSignal_from_FFT_str(const string &FFTString) {
     }
     return error;
 }
-unsigned int KClmtr::parseN5Command(const string &FFTString, double &outX, double &outY, double &outZ, MeasurementRange &outRange) {
-    //15 char long string
-    string xyzString = "";
+unsigned int KClmtr::parseN5Command(const ByteView &FFTString, double &outX, double &outY, double &outZ, MeasurementRange &outRange) {
+    //15 char long string, spread out over every third byte
+    unsigned char xyzString[3];
     //X
-    xyzString = FFTString.substr(6, 1);
-    xyzString += FFTString.substr(9, 1);
-    xyzString += FFTString.substr(12, 1);
+    xyzString[0] = FFTString[6];
+    xyzString[1] = FFTString[9];
+    xyzString[2] = FFTString[12];
 
     outX = parseK_float(xyzString);
 
     //Y
-    xyzString = FFTString.substr(15, 1);
-    xyzString += FFTString.substr(18, 1);
-    xyzString += FFTString.substr(21, 1);
+    xyzString[0] = FFTString[15];
+    xyzString[1] = FFTString[18];
+    xyzString[2] = FFTString[21];
 
     outY = parseK_float(xyzString);
 
     //Z
-    xyzString = FFTString.substr(24, 1);
-    xyzString += FFTString.substr(27, 1);
-    xyzString += FFTString.substr(30, 1);
+    xyzString[0] = FFTString[24];
+    xyzString[1] = FFTString[27];
+    xyzString[2] = FFTString[30];
 
     outZ = parseK_float(xyzString);
 
     //Range
     int ranges[3];
-    parsingRange(FFTString.substr(33, 1).c_str()[0], ranges);
+    parsingRange(FFTString[33], ranges);
     outRange = (MeasurementRange)ranges[1];
 
     //Error
     // <0>
     //xyzString += FFTString.substr(36, 1);
-    return KleinsErrorCodes::getErrorCodeFromKlein(FFTString.substr(39, 1));
+    return KleinsErrorCodes::getErrorCodeFromKlein(string(1, (char)FFTString[39]));
     //xyzString += FFTString.substr(42, 1);
 
     //return parseAndPrintXYZ(N5CommandString);
@@ -2189,8 +3107,12 @@ unsigned int KClmtr::parseN5Command(const string &FFTString, double &outX, doubl
 
 //Send/Reseving
 unsigned int KClmtr::sendMessageToKColorimeter(const command &m) {
-    string readString;
-    return sendMessageToKColorimeter(m, readString);
+    if(isQueueable(m.commandString, m.expected)) {
+        string readString;
+        return queueCommand(m.commandString, m.expected, m.timeout, readString);
+    }
+    Frame reply;
+    return sendMessageToKColorimeter(m, reply);
 }
 unsigned int KClmtr::sendMessageToKColorimeter(const command &m, string &readString) {
     return sendMessageToKColorimeter(m.commandString, m.expected, m.timeout, readString);
@@ -2200,6 +3122,333 @@ unsigned int KClmtr::sendMessageToKColorimeter(const string &strMsg, int expecte
     return sendMessageToKColorimeter(strMsg, expected, timeOut_Sec, readString);
 }
 unsigned int KClmtr::sendMessageToKColorimeter(const string &strMsg, int expected, int timeOut_Sec, string &readString) {
+    if(isQueueable(strMsg, expected)) {
+        return queueCommand(strMsg, expected, timeOut_Sec, readString);
+    }
+    stopStreamingFor(strMsg, expected);
+    drainCancelledReply();
+    long long start = monotonicMicroseconds();
+    unsigned int error = sendMessageToSerialPort(*m_transport, m_decoder, strMsg, expected, timeOut_Sec, readString, &m_timeouts);
+    if(error == KleinsErrorCodes::NONE) {
+        setThroughput(readString.size(), start);
+    }
+    return error;
+}
+unsigned int KClmtr::sendMessageToKColorimeter(const command &m, Frame &reply) {
+    stopStreamingFor(m.commandString, m.expected);
+    drainCancelledReply();
+    long long start = monotonicMicroseconds();
+    unsigned int error = sendMessageToSerialPort(*m_transport, m_decoder, m.commandString, m.expected, m.timeout, reply, &m_timeouts);
+    if(error == KleinsErrorCodes::NONE) {
+        setThroughput(reply.bytes.size, start);
+    }
+    return error;
+}
+unsigned int KClmtr::sendBatchToKColorimeter(const vector<command> &batch, vector<batchReply> &replies) {
+    replies.assign(batch.size(), batchReply());
+    for(size_t i = 0; i < batch.size(); ++i) {
+        if(isQueueable(batch[i].commandString, batch[i].expected)) {
+            //The stream sends them between its frames, one at a time
+            unsigned int error = KleinsErrorCodes::NONE;
+            for(size_t j = 0; j < batch.size(); ++j) {
+                replies[j].error = sendMessageToKColorimeter(batch[j].commandString, batch[j].expected, batch[j].timeout, replies[j].reply);
+                replies[j].time = monotonicMicroseconds();
+                error |= replies[j].error;
+            }
+            return error;
+        }
+    }
+    for(size_t i = 0; i < batch.size(); ++i) {
+        stopStreamingFor(batch[i].commandString, batch[i].expected);
+    }
+    drainCancelledReply();
+    long long start = monotonicMicroseconds();
+    size_t total = 0;
+    unsigned int error = sendBatchToSerialPort(*m_transport, m_decoder, batch, replies, &m_timeouts);
+    for(size_t i = 0; i < replies.size(); ++i) {
+        total += replies[i].reply.size();
+    }
+    if(error == KleinsErrorCodes::NONE && total > 0) {
+        setThroughput(total, start);
+    }
+    return error;
+}
+//Command queue
+long KClmtr::getLastQueueWait() const {
+    return m_lastQueueWait;
+}
+long KClmtr::getLastStopWait() const {
+    return m_lastStopWait;
+}
+void KClmtr::drainCancelledReply() {
+    if(m_drainUntil == 0) {
+        return;
+    }
+    long long until = m_drainUntil;
+    m_drainUntil = 0;
+    //The decoder is still looking for it
+    RingBuffer &received = m_transport->receiveBuffer();
+    while(m_decoder.expecting() != Frame::NONE && m_transport->isOpen()) {
+        if(!received.empty()) {
+            Frame last;
+            received.consume(m_decoder.feed(received.view(received.size()), last));
+            if(last.type != Frame::NONE) {
+                return;
+            }
+        }
+        long long remaining = until - monotonicMicroseconds();
+        if(remaining <= 0) {
+            return;
+        }
+        m_transport->receive(m_decoder.needed(), (long)((remaining + 999) / 1000));
+    }
+}
+bool KClmtr::isStreamThread() const {
+    lockThread();
+#ifdef WIN32
+    bool is = threadId == GetCurrentThreadId();
+#else
+    bool is = pthread_equal(threadId, pthread_self()) != 0;
+#endif
+    unlockThread();
+    return is;
+}
+bool KClmtr::isQueueable(const string &strMsg, int expected) const {
+    //Flicker keeps sending until it is stopped, so nothing can go in between
+    if(childMode() != RUN || measureMode == FLICKER || isStreamThread()) {
+        return false;
+    }
+    //Only one shot commands, the ones that need a second message can't have a N5 in the middle
+    return expected >= 0 && strMsg.size() == 2 &&
+           (strMsg[0] == 'J' || strMsg[0] == 'L');
+}
+int KClmtr::commandPriority(const string &strMsg) {
+    //The range changes what the next measurement means, so it goes first
+    if(strMsg[0] == 'J') {
+        return 1;
+    }
+    return 0;
+}
+void KClmtr::lockThread() const {
+#ifdef WIN32
+    EnterCriticalSection(&m_threadLock);
+#else
+    pthread_mutex_lock(&m_threadLock);
+#endif
+}
+void KClmtr::unlockThread() const {
+#ifdef WIN32
+    LeaveCriticalSection(&m_threadLock);
+#else
+    pthread_mutex_unlock(&m_threadLock);
+#endif
+}
+void KClmtr::waitThread() {
+#ifdef WIN32
+    SleepConditionVariableCS(&m_threadChanged, &m_threadLock, INFINITE);
+#else
+    pthread_cond_wait(&m_threadChanged, &m_threadLock);
+#endif
+}
+bool KClmtr::waitThreadUntil(long long deadline) {
+    long long remaining = deadline - monotonicMicroseconds();
+    if(remaining <= 0) {
+        return false;
+    }
+#ifdef WIN32
+    SleepConditionVariableCS(&m_threadChanged, &m_threadLock, (DWORD)((remaining + 999) / 1000));
+#else
+    struct timespec ts;
+#ifdef __APPLE__
+    ts.tv_sec = (time_t)(remaining / 1000000);
+    ts.tv_nsec = (long)(remaining % 1000000) * 1000;
+    pthread_cond_timedwait_relative_np(&m_threadChanged, &m_threadLock, &ts);
+#else
+    //The condition is on CLOCK_MONOTONIC, the same as the deadline
+    ts.tv_sec = (time_t)(deadline / 1000000);
+    ts.tv_nsec = (long)(deadline % 1000000) * 1000;
+    pthread_cond_timedwait(&m_threadChanged, &m_threadLock, &ts);
+#endif
+#endif
+    return true;
+}
+void KClmtr::signalThread() {
+#ifdef WIN32
+    WakeAllConditionVariable(&m_threadChanged);
+#else
+    pthread_cond_broadcast(&m_threadChanged);
+#endif
+}
+void KClmtr::lockCallbacks() const {
+#ifdef WIN32
+    EnterCriticalSection(&m_callbackLock);
+#else
+    pthread_mutex_lock(&m_callbackLock);
+#endif
+}
+void KClmtr::unlockCallbacks() const {
+#ifdef WIN32
+    LeaveCriticalSection(&m_callbackLock);
+#else
+    pthread_mutex_unlock(&m_callbackLock);
+#endif
+}
+void KClmtr::waitCallbacks() {
+#ifdef WIN32
+    SleepConditionVariableCS(&m_callbackChanged, &m_callbackLock, INFINITE);
+#else
+    pthread_cond_wait(&m_callbackChanged, &m_callbackLock);
+#endif
+}
+void KClmtr::signalCallbacks() {
+#ifdef WIN32
+    WakeAllConditionVariable(&m_callbackChanged);
+#else
+    pthread_cond_broadcast(&m_callbackChanged);
+#endif
+}
+KClmtr::_ThreadMode KClmtr::parentMode() const {
+    lockThread();
+    _ThreadMode mode = threadModeParent;
+    unlockThread();
+    return mode;
+}
+KClmtr::_ThreadMode KClmtr::childMode() const {
+    lockThread();
+    _ThreadMode mode = threadModeChild;
+    unlockThread();
+    return mode;
+}
+void KClmtr::setParentMode(_ThreadMode mode) {
+    lockThread();
+    threadModeParent = mode;
+    unlockThread();
+}
+void KClmtr::setChildMode(_ThreadMode mode) {
+    lockThread();
+    threadModeChild = mode;
+    //Always from the thread running the stream, so isStreamThread() is right before the parent hears about it
+    if(mode == RUN) {
+        ++m_childStarts;
+#ifdef WIN32
+        threadId = GetCurrentThreadId();
+#else
+        threadId = pthread_self();
+#endif
+    } else if(mode == NOT_RUNNING) {
+        threadId = 0;
+    }
+    signalThread();
+    unlockThread();
+}
+void KClmtr::waitForChildStop() {
+    lockThread();
+    while(threadModeChild != NOT_RUNNING) {
+        waitThread();
+    }
+    unlockThread();
+}
+void KClmtr::joinStreamThread() {
+#ifndef WIN32
+    if(m_streamJoinable && !pthread_equal(m_streamThread, pthread_self())) {
+        pthread_join(m_streamThread, NULL);
+        m_streamJoinable = false;
+    }
+#endif
+}
+void KClmtr::lockQueue() {
+#ifdef WIN32
+    EnterCriticalSection(&m_queueLock);
+#else
+    pthread_mutex_lock(&m_queueLock);
+#endif
+}
+void KClmtr::unlockQueue() {
+#ifdef WIN32
+    LeaveCriticalSection(&m_queueLock);
+#else
+    pthread_mutex_unlock(&m_queueLock);
+#endif
+}
+bool KClmtr::hasQueuedCommands() {
+    lockQueue();
+    bool has = !m_commandQueue.empty();
+    unlockQueue();
+    return has;
+}
+unsigned int KClmtr::queueCommand(const string &strMsg, int expected, int timeOut_Sec, string &readString) {
+    queuedCommand q;
+    q.commandString = strMsg;
+    q.expected = expected;
+    q.timeout = timeOut_Sec;
+    q.priority = commandPriority(strMsg);
+    q.queuedAt = monotonicMicroseconds();
+    q.done = false;
+    q.error = KleinsErrorCodes::NONE;
+
+    lockQueue();
+    //Behind everything with the same or a higher priority
+    vector<queuedCommand *>::iterator at = m_commandQueue.begin();
+    while(at != m_commandQueue.end() && (*at)->priority >= q.priority) {
+        ++at;
+    }
+    m_commandQueue.insert(at, &q);
+    unlockQueue();
+
+    lockThread();
+    while(!q.done && threadModeChild == RUN) {
+        waitThread();
+    }
+    bool done = q.done;
+    unlockThread();
+    if(!done) {
+        //The stream stopped before getting to it, so it is sent from here
+        lockQueue();
+        vector<queuedCommand *>::iterator found = find(m_commandQueue.begin(), m_commandQueue.end(), &q);
+        bool removed = found != m_commandQueue.end();
+        if(removed) {
+            m_commandQueue.erase(found);
+        }
+        unlockQueue();
+        if(removed) {
+            drainCancelledReply();
+            return sendMessageToSerialPort(*m_transport, m_decoder, strMsg, expected, timeOut_Sec, readString, &m_timeouts);
+        }
+        //The stream took it just before it stopped, it finishes it first
+        lockThread();
+        while(!q.done) {
+            waitThread();
+        }
+        unlockThread();
+    }
+    readString = q.reply;
+    return q.error;
+}
+void KClmtr::serviceCommandQueue() {
+    for(;;) {
+        lockQueue();
+        if(m_commandQueue.empty()) {
+            unlockQueue();
+            return;
+        }
+        queuedCommand *q = m_commandQueue.front();
+        m_commandQueue.erase(m_commandQueue.begin());
+        unlockQueue();
+
+        long wait = (long)(monotonicMicroseconds() - q->queuedAt);
+        m_lastQueueWait = wait;
+        string commandString = q->commandString;
+        drainCancelledReply();
+        q->error = sendMessageToSerialPort(*m_transport, m_decoder, q->commandString, q->expected, q->timeout, q->reply, &m_timeouts);
+        //The caller can go away as soon as this is set
+        lockThread();
+        q->done = true;
+        signalThread();
+        unlockThread();
+        printQueueWait(commandString, wait);
+    }
+}
+void KClmtr::stopStreamingFor(const string &strMsg, int expected) {
     if(isMeasuring() &&
             (strMsg != COLOR_2PERSECOND.commandString &&
              strMsg != COLOR_4PERSECOND.commandString &&
@@ -2216,20 +3465,30 @@ unsigned int KClmtr::sendMessageToKColorimeter(const string &strMsg, int expecte
              strMsg != FLICKER_384PERSECOND.commandString)) {
         stopFlicker();
     }
-    return sendMessageToSerialPort(m_CommPort, strMsg, expected, timeOut_Sec, readString);
 }
 unsigned int KClmtr::readFromKColorimeter(int expected, long timeOut_Sec, string &readString) {
-    if(m_CommPort.isOpen()) {
+    //Nothing to check, just the length
+    m_decoder.expect("", expected);
+    Frame reply;
+    unsigned int error = readFromKColorimeter(timeOut_Sec, reply);
+    readString.assign(reinterpret_cast<const char *>(reply.bytes.data), reply.bytes.size);
+    return error;
+}
+unsigned int KClmtr::readFromKColorimeter(long timeOut_Sec, Frame &reply) {
+    reply = Frame();
+    if(m_transport->isOpen()) {
         if(!m_Flickering) {
             //simply clear the port buffer in case it has junk left from a previous cmd
-            m_CommPort.readExisting();
-            readString = "";
+            m_transport->discardExisting();
             return KleinsErrorCodes::TIMED_OUT;
         } else {
             unsigned int error = KleinsErrorCodes::NONE;
-            error |= readFromSerialPort(m_CommPort, expected, timeOut_Sec, readString);
+            long long start = monotonicMicroseconds();
+            error |= readFromSerialPort(*m_transport, m_decoder, timeOut_Sec, reply);
             if(error & KleinsErrorCodes::LOST_CONNECTION) {
                 closePort();
+            } else if(error == KleinsErrorCodes::NONE) {
+                setThroughput(reply.bytes.size, start);
             }
             return error;
         }
@@ -2239,27 +3498,34 @@ unsigned int KClmtr::readFromKColorimeter(int expected, long timeOut_Sec, string
     }
 }
 
-unsigned int KClmtr::sendMessageToSerialPort(SerialPort &comPort, const command &m, string &readString) {
-    return sendMessageToSerialPort(comPort, m.commandString, m.expected, m.timeout, readString);
+unsigned int KClmtr::sendMessageToSerialPort(Transport &comPort, FrameDecoder &decoder, const command &m, string &readString) {
+    return sendMessageToSerialPort(comPort, decoder, m.commandString, m.expected, m.timeout, readString);
 }
-unsigned int KClmtr::sendMessageToSerialPort(SerialPort &comPort, const string &strMsg, int expected, int timeOut_Sec, string &readString) {
+unsigned int KClmtr::sendMessageToSerialPort(Transport &comPort, FrameDecoder &decoder, const string &strMsg, int expected, int timeOut_Sec, string &readString, AdaptiveTimeout *timer, long long limit) {
+    Frame reply;
+    unsigned int error = sendMessageToSerialPort(comPort, decoder, strMsg, expected, timeOut_Sec, reply, timer, limit);
+    readString.assign(reinterpret_cast<const char *>(reply.bytes.data), reply.bytes.size);
+    return error;
+}
+unsigned int KClmtr::sendMessageToSerialPort(Transport &comPort, FrameDecoder &decoder, const string &strMsg, int expected, int timeOut_Sec, Frame &reply, AdaptiveTimeout *timer, long long limit) {
     unsigned int error = KleinsErrorCodes::NONE;
+    reply = Frame();
     try {
-        string commandString = string(strMsg);
-        readString = "";
         //If it is open then we can move one
         if(comPort.isOpen()) {
             //Remove all bits out of the K10/8
             //m_CommPort.DiscardOutBuffer();
             //simply clear the port buffer in case it has junk left from a previous cmd
-            comPort.readExisting();
-            //Adds /r to the end of the command
-            commandString.append(1, '\r');
-            const unsigned char *myRead = reinterpret_cast<const unsigned char *>(commandString.c_str());
+            comPort.discardExisting();
+            //Getting ready for what comes back
+            decoder.expect(strMsg, expected);
             //Send the command to the K10/8
-            comPort.writePort(myRead, commandString.length());
+            if(timer != NULL) {
+                timer->begin(strMsg, expected, comPort.getSpeed());
+            }
+            writeToSerialPort(comPort, strMsg);
             if(expected > 0) {
-                error |= readFromSerialPort(comPort, expected, timeOut_Sec, readString);
+                error |= readFromSerialPort(comPort, decoder, timeOut_Sec, reply, timer, limit);
             }
             return error;
         } else {
@@ -2272,33 +3538,102 @@ unsigned int KClmtr::sendMessageToSerialPort(SerialPort &comPort, const string &
         return error;
     }
 }
-unsigned int KClmtr::readFromSerialPort(SerialPort &comPort, int expected, long timeOut_Sec, string &readString) {
+unsigned int KClmtr::sendBatchToSerialPort(Transport &comPort, FrameDecoder &decoder, const vector<command> &batch, vector<batchReply> &replies, AdaptiveTimeout *timer) {
+    replies.assign(batch.size(), batchReply());
+    try {
+        if(!comPort.isOpen()) {
+            for(size_t i = 0; i < replies.size(); ++i) {
+                replies[i].error = KleinsErrorCodes::NOT_OPEN;
+            }
+            return KleinsErrorCodes::NOT_OPEN;
+        }
+        comPort.discardExisting();
+        //All of them in one write, each with its own \r
+        string commandString;
+        for(size_t i = 0; i < batch.size(); ++i) {
+            commandString.append(batch[i].commandString);
+            commandString.append(1, '\r');
+        }
+        comPort.writePort(reinterpret_cast<const unsigned char *>(commandString.c_str()), commandString.length());
+
+        //The device answers in order, so each reply is cut off by its length
+        //and whatever comes after it stays in the buffer for the next one
+        unsigned int error = KleinsErrorCodes::NONE;
+        for(size_t i = 0; i < batch.size(); ++i) {
+            const command &m = batch[i];
+            if(error != KleinsErrorCodes::NONE) {
+                //Can't tell where the rest start anymore
+                replies[i].error = error;
+                continue;
+            }
+            decoder.expect(m.commandString, m.expected);
+            if(m.expected <= 0) {
+                continue;
+            }
+            //Timed from when the one before it finished, that is when the device gets to it
+            if(timer != NULL) {
+                timer->begin(m.commandString, m.expected, comPort.getSpeed());
+            }
+            Frame reply;
+            replies[i].error = readFromSerialPort(comPort, decoder, m.timeout, reply, timer);
+            replies[i].reply.assign(reinterpret_cast<const char *>(reply.bytes.data), reply.bytes.size);
+            replies[i].time = reply.time;
+            error |= replies[i].error;
+        }
+        return error;
+    } catch(...) {
+        return KleinsErrorCodes::LOST_CONNECTION;
+    }
+}
+void KClmtr::writeToSerialPort(Transport &comPort, const string &strMsg) {
+    //Adds /r to the end of the command
+    string commandString = strMsg;
+    commandString.append(1, '\r');
+    const unsigned char *myRead = reinterpret_cast<const unsigned char *>(commandString.c_str());
+    comPort.writePort(myRead, commandString.length());
+}
+unsigned int KClmtr::readFromSerialPort(Transport &comPort, FrameDecoder &decoder, long timeOut_Sec, Frame &reply, AdaptiveTimeout *timer, long long limit) {
     try {
-        int i = 0;
         //Makes sure if it Times out it will let the user know
         //If it is open then we can move one
         if(comPort.isOpen()) {
-            readString += comPort.readExisting();
-            //20 means 1 second
             //1.5 is added to make sure there isn't a range change
             //interrupting our commucation.
-            timeOut_Sec *= 30;//20 * 1.5
-
-            i = 0;
-            //Goes until Times Out
-            while(comPort.isOpen() && i < timeOut_Sec) {
-                //Makes the PC sleeps so we can check the K10/8
-                sleep(50);
-                //Stores what is on the K10/8
-                readString += comPort.readExisting();
-
-                //Checks if we got all the info
-                if((int)readString.length() < expected) {
-                    ++i;
-                } else {
-                    //If we got all the info we will do something with the ReadString
-                    return KleinsErrorCodes::NONE;
+            long long start = monotonicMicroseconds();
+            long long deadline = timer != NULL ? timer->deadline(timeOut_Sec) : start + timeOut_Sec * 1500000LL;
+            bool heard = false;
+            RingBuffer &received = comPort.receiveBuffer();
+            while(decoder.expecting() != Frame::NONE) {
+                //The decoder stops at the end of a frame, the rest stays for next time
+                if(!received.empty()) {
+                    heard = true;
+                    received.consume(decoder.feed(received.view(received.size()), reply));
+                    if(reply.type != Frame::NONE) {
+                        reply.time = comPort.getLastReadTime();
+                        if(timer != NULL) {
+                            timer->finish();
+                        }
+                        return KleinsErrorCodes::NONE;
+                    }
+                }
+                if(comPort.isCancelled()) {
+                    break;
+                }
+                long long remaining = deadline - monotonicMicroseconds();
+                if(remaining <= 0 && heard && timer != NULL && deadline < start + timeOut_Sec * 1500000LL) {
+                    //The device is answering, just slower than it normally does
+                    deadline = start + timeOut_Sec * 1500000LL;
+                    remaining = deadline - monotonicMicroseconds();
                 }
+                if(limit > 0 && deadline > limit) {
+                    deadline = limit;
+                    remaining = deadline - monotonicMicroseconds();
+                }
+                if(remaining <= 0 || !comPort.isOpen()) {
+                    break;
+                }
+                //Waits, waking up as soon as there is enough to finish the frame
+                comPort.receive(decoder.needed(), (long)((remaining + 999) / 1000));
             }
         } else {
             //If not then we need to let the user know that it should be open
@@ -2328,14 +3663,16 @@ bool KClmtr::setSerialNumberValues(const string &read, string &model, string &SN
     }
     return false;
 }
-bool KClmtr::getModelSN(SerialPort &comPort, string &model, string &SN) {
+bool KClmtr::getModelSN(Transport &comPort, string &model, string &SN, long long limit) {
     string returnString;
-    if(sendMessageToSerialPort(comPort, DEVICE_INFO, returnString) == (int)KleinsErrorCodes::NONE) {
+    FrameDecoder decoder;
+    const command &m = DEVICE_INFO;
+    if(sendMessageToSerialPort(comPort, decoder, m.commandString, m.expected, m.timeout, returnString, NULL, limit) == (int)KleinsErrorCodes::NONE) {
         if(returnString.substr(0, 5) == "//////") {
             //Clearning the K10
-            sendMessageToSerialPort(comPort, "P0", 131, 1, returnString);
+            sendMessageToSerialPort(comPort, decoder, "P0", 131, 1, returnString, NULL, limit);
             returnString = "";
-            if(sendMessageToSerialPort(comPort, DEVICE_INFO, returnString) == (int)KleinsErrorCodes::NONE) {
+            if(sendMessageToSerialPort(comPort, decoder, m.commandString, m.expected, m.timeout, returnString, NULL, limit) == (int)KleinsErrorCodes::NONE) {
                 //Getting the Model and SerialNumber
                 return setSerialNumberValues(returnString, model, SN);
             }
@@ -2352,25 +3689,55 @@ bool KClmtr::connect(const string &portName) {
 }
 bool KClmtr::connect() {
     try {
-        if(m_CommPort.openPort()) {
-            m_CommPort.setSetting(9600, 8, 'n', 10000);
+        if(m_transport->openPort() && m_transport->setSetting(m_baudRate, 8, 'n', 10000)) {
             m_isOpen = true;
         } else {
             m_isOpen = false;
         }
 
-        if(!m_CommPort.isOpen()) {
+        if(!m_transport->isOpen()) {
             return false;
         }
+        //A different device can take a different time to answer
+        m_timeouts.reset();
+        //Only what comes from this device, the connect cache is kept under it
+        m_firmware = "";
+        m_drainUntil = 0;
+        resetStreamCounters();
         //Making sure it's a Klein product
-        if(getModelSN(m_CommPort, m_Model, m_SerialNumber)) {
+        if(getModelSN(*m_transport, m_Model, m_SerialNumber)) {
             //Check and see if its a K 8 or a 10 or not
             string returnString = "";
-            if(sendMessageToKColorimeter(CALFILE_FILELIST, returnString) == 0) {
+            //The range goes out with the first long reply, P0 has to come back
+            //first to know it is a Klein device and to look in the cache.
+            //With the cache on, that is P4. It has the firmware the saved cal file list is kept under,
+            //and the names of the first 10 cal files to check it against. The KV- have no P4
+            bool useCache = m_connectCache.isEnabled() && m_Model.find("KV-") != 0;
+            vector<command> batch;
+            batch.push_back(useCache ? FLICKER_INFO : CALFILE_FILELIST);
+            m_range = -1;
+            rangeCommands(m_range, batch);
+            vector<batchReply> replies;
+            sendBatchToKColorimeter(batch, replies);
+            unsigned int error = replies[0].error;
+            if(useCache) {
+                //It is the flicker startup string too, so startFlicker() does not ask again
+                if(error != KleinsErrorCodes::NONE ||
+                        printStartupString(replies[0].reply) != KleinsErrorCodes::NONE ||
+                        !loadCachedCalFileList(replies[0].reply, returnString)) {
+                    error = fetchAndCache(CALFILE_FILELIST, returnString);
+                    if(error == KleinsErrorCodes::NONE) {
+                        ++m_cacheMisses;
+                        printCache(CALFILE_FILELIST.commandString, false, 0);
+                    }
+                }
+            } else if(error == KleinsErrorCodes::NONE) {
+                returnString = replies[0].reply;
+            }
+            if(error == KleinsErrorCodes::NONE) {
                 //Get all the CalFiles on the K10/8
                 setCalFileList(returnString);
                 setCalFileID(getCalFileID());
-                setRange(-1);
                 setMaxAverageCount(32);
                 return true;
             }
@@ -2381,18 +3748,19 @@ bool KClmtr::connect() {
         return false;
     }
 }
-bool KClmtr::testConnection(const string &portName, string &model, string &SN) {
+bool KClmtr::testConnection(const string &portName, string &model, string &SN, long timeOut_ms) {
+    long long limit = timeOut_ms > 0 ? monotonicMicroseconds() + timeOut_ms * 1000LL : 0;
     try {
         SerialPort CommPort;
         CommPort.portName = portName;
         if(CommPort.openPort()) {
-            CommPort.setSetting(9600, 8, 'n', 10000);
+            CommPort.setSetting(defaultBaudRate, 8, 'n', 10000);
         } else {
             return false;
         }
 
         //Making sure it's a Klein product
-        bool r = getModelSN(CommPort, model, SN);
+        bool r = getModelSN(CommPort, model, SN, limit);
         CommPort.closePort();
         return r;
     } catch(...) {
@@ -2412,7 +3780,7 @@ void KClmtr::closePort() {
     }
 
     try {
-        m_CommPort.closePort();
+        m_transport->closePort();
     } catch(...) { /*ERROR*/  }
     for(int i = 1; i < 99; ++i) {
         m_CalFileList[i] = "";
@@ -2462,10 +3830,31 @@ void KClmtr::stopMeasureCounts() {
 bool KClmtr::isMeasureCounts() const {
     return m_MeasuringM6;
 }
+size_t KClmtr::drainMeasureCounts(vector<Counts> &out) {
+    size_t n = 0;
+    Counts c;
+    while(m_countsQueue.pop(c)) {
+        out.push_back(c);
+        ++n;
+    }
+    return n;
+}
+bool KClmtr::popMeasureCounts(Counts &c) {
+    return m_countsQueue.pop(c);
+}
 bool KClmtr::getMeasureCounts(Counts &c) {
+    lockThread();
     c = m_counts;
     bool temp = m_isCountsfresh;
     m_isCountsfresh = false;
+    unlockThread();
+    return temp;
+}
+bool KClmtr::waitForMeasureCounts(Counts &c, long timeOut_ms) {
+    bool temp = waitForFresh(m_isCountsfresh, timeOut_ms);
+    c = m_counts;
+    m_isCountsfresh = false;
+    unlockThread();
     return temp;
 }
 Counts KClmtr::getNextMeasureCount() {
@@ -2475,11 +3864,14 @@ Counts KClmtr::getNextMeasureCount() {
         return Counts(error);
     }
     //Getting Measurement
-    string returnString;
+    Frame returnString;
     error = sendMessageToKColorimeter(COUNTS_4PERSECOND, returnString);
     if(error != KleinsErrorCodes::NONE) {
         return Counts(error);
     }
 
-    return Counts(returnString);
+    Counts counts(returnString.bytes);
+    m_frameSequence = 0;
+    stampFrame(counts, returnString);
+    return counts;
 }
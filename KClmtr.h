@@ -25,8 +25,13 @@ OTHER DEALINGS IN THE SOFTWARE.
 #pragma once
 
 #include "string.h"
+#include <vector>
 
 #include "SerialPort.h"
+#include "FrameDecoder.h"
+#include "ConnectCache.h"
+#include "AdaptiveTimeout.h"
+#include "SpscQueue.h"
 #include "BlackMatrix.h"
 #include "Flicker.h"
 #include "Measurement.h"
@@ -42,6 +47,7 @@ OTHER DEALINGS IN THE SOFTWARE.
 
 namespace KClmtrBase {
 namespace KClmtrNative {
+class KClmtrReactor;
 static const int polyDegree = 5; //Including 0th term
 
 /**
@@ -61,11 +67,36 @@ struct CorrectedCoefficient {
         error = 0;
     }
 };
+/**
+* @brief How printMeasure(), printFlicker() or printCounts() is keeping up with the stream
+* @see KClmtr::setCallbackQueueSize()
+*/
+struct CallbackStats {
+    unsigned long delivered;	/**< How many times it was called */
+    unsigned long dropped;		/**< Frames it was not called for, the queue was full */
+    long lastWait_us;			/**< From the last byte of the frame being read to the last call starting */
+    long maxWait_us;			/**< The longest wait */
+    long lastRun_us;			/**< How long the last call took */
+    long maxRun_us;				/**< The longest call */
+
+    CallbackStats() {
+        delivered = 0;
+        dropped = 0;
+        lastWait_us = 0;
+        maxWait_us = 0;
+        lastRun_us = 0;
+        maxRun_us = 0;
+    }
+};
 /**
  * @brief Object to control a Klein Device
  *
  */
 class KClmtr {
+    //Runs commands on its own thread, it needs sendMessageToKColorimeter()
+    friend class KClmtrAsync;
+    //Runs the streams of many devices on one thread
+    friend class KClmtrReactor;
 public:
     /**
     * @brief constructor
@@ -95,6 +126,139 @@ public:
      * @return bool
      */
     bool isPortOpen();	//Can't be const, for it needs to call API
+    /**
+     * @brief Talks through something other than the serial port, like a MemoryTransport or PtyTransport.
+     * The port is closed first. setPort() and connect() then go to the transport.
+     *
+     * @param transport Must outlive the KClmtr or the next setTransport(), NULL goes back to the serial port
+     */
+    void setTransport(Transport *transport);
+    /**
+     * @brief What KClmtr is talking through
+     *
+     * @return the serial port, unless setTransport() was used
+     */
+    Transport *getTransport();
+    /**
+     * @brief How long the last reply took to show up after we started waiting for it
+     *
+     * @return latency in microseconds
+     */
+    long getLastReadLatency() const;
+    /**
+     * @brief Saves every byte to and from the device in a capture file, with when it came.
+     * Play it back through FileReplayTransport to see the same thing again without the device.
+     *
+     * @param fileName Where to save it, anything already there is lost
+     * @return false if the file could not be made
+     * @see CaptureLog
+     */
+    bool startCapture(const std::string &fileName);
+    /**
+     * @brief Stops saving and closes the capture file
+     */
+    void stopCapture();
+    /**
+     * @brief Is a capture being saved
+     */
+    bool isCapturing() const;
+    /**
+     * @brief Keeps the cal file list (D7, 1925 bytes) of each device on disk, so connecting to it again does not have to wait for it
+     * @details connect() then asks for the flicker startup string (P4, 613 bytes) in its place, which startFlicker() needs anyway.
+     * The saved list is only used if it was saved under the firmware in that P4, and the names of cal files 1 to 10 in P4 match it.
+     * When the cal files are changed with storeMatrices() or deleteCalFile() the saved list is changed too.
+     * @details What it can't see: cal files 11 to 96 changed by another program or another computer, when the firmware and
+     * the first 10 names are the same. Call clearConnectCache() after changing them somewhere else. The KV- have no P4, nothing is saved for them.
+     *
+     * @param directory Where to keep them, like ConnectCache::defaultDirectory(). "" turns it off, which is the default
+     */
+    void setConnectCache(const std::string &directory);
+    std::string getConnectCache() const;
+    /**
+     * @brief Throws away everything saved for the device that is connected, the next connect() gets it from the device
+     * @see setConnectCache
+     */
+    void clearConnectCache();
+    /**
+     * @brief Replies that came from the cache since the KClmtr was made
+     */
+    int getCacheHits() const;
+    /**
+     * @brief Replies that had to come from the device with the cache on
+     */
+    int getCacheMisses() const;
+    /**
+     * @brief How much time the cache hits saved, from how long the replies took to get from the device
+     *
+     * @return microseconds
+     */
+    long long getCacheTimeSaved() const;
+    /**
+     * @brief Waits for a reply only as long as this device has been taking, from the baud rate,
+     * the size of the reply and the times of the last replies, instead of each command's fixed time out
+     * @details A dead device is found in a few times the normal reply time, not seconds.
+     * Each command uses its fixed time out until it has come back a few times, and never waits longer than it.
+     * If part of the reply has come in, it waits the fixed time out for the rest.
+     * A range change can hold up a reply for longer than normal, so too small a factor gives false TIMED_OUT.
+     *
+     * @param factor How many times longer than normal to wait, 3 is a good start. 0 turns it off, which is the default
+     */
+    void setTimeoutSafetyFactor(double factor);
+    double getTimeoutSafetyFactor() const;
+    /**
+     * @brief How long the last command was given to reply
+     *
+     * @return microseconds
+     */
+    long long getLastTimeout() const;
+    /**
+     * @brief The average time from sending a command to having all of its reply, since connect()
+     *
+     * @param commandString The command, like "N5"
+     * @return microseconds, -1 if it has not been sent
+     */
+    long long getRoundTrip(const std::string &commandString) const;
+    /**
+     * @brief Has the USB serial adapter pass on bytes as soon as they come in, which takes
+     * most of the wait out of each reply on FTDI adapters. Used from the next connect().
+     * @see SerialPort::setLowLatency
+     * @param lowLatency on or off, off is the default
+     */
+    void setLowLatency(bool lowLatency);
+    bool getLowLatency() const;
+    /**
+     * @brief How fast the last reply came in, from sending the command to having all of it.
+     * While flickering, it is the rate of the frames coming in.
+     *
+     * @return bytes per second
+     */
+    double getThroughput() const;
+    /**
+     * @brief Sets the baud rate the host side of the port opens at on the next connect.
+     * The device is not told about it, it has to already be at this rate. Refused while the port is open,
+     * changing only the host side of a live link would just cut it off, use detectBaudRate() for that
+     *
+     * @param speed Any rate the serial port can make, the default is 9600
+     * @return true if the rate was taken, false if the port is open
+     */
+    bool setBaudRate(int speed);
+    /**
+     * @brief Gets the baud rate used to talk to the device
+     *
+     * @return int baud rate
+     */
+    int getBaudRate() const;
+    /**
+     * @brief Probes which rate, up to maxSpeed, the device is answering at and moves the host side to it.
+     * This does not reconfigure the device, there is no command for that, it only finds the rate the
+     * device was already set to. The current rate is checked first, then the others fastest first.
+     * Each one is checked against the serial number, a rate the device is not at costs a read timeout.
+     * Needs to be connected first.
+     *
+     * @param maxSpeed The fastest rate to try
+     * @return int The rate that is now used, or 0 if none answered and the last rate is kept
+     */
+    int detectBaudRate(int maxSpeed = 921600);
     /**
      * @brief After KClmtr is open, returns the Serial Number of the Klein Device
      *
@@ -331,6 +495,55 @@ public:
     * @see speedMode
     */
     void setMeasureSpeedMode(SpeedMode value);
+    /**
+    * @brief Is startMeasuring() sending the next command before the last reply is parsed
+    * @see setMeasurePipelined
+    */
+    bool getMeasurePipelined() const;
+    /**
+    * @brief When on, startMeasuring() keeps one command in the device while the last reply is parsed and printed,
+    * so time spent in printMeasure() does not slow down the measurements. Off by default.
+    * @param pipelined on or off
+    */
+    void setMeasurePipelined(bool pipelined);
+    /**
+    * @brief The number of measurements per second coming from startMeasuring(), since it was started
+    * @return frames per second, 0 until there are two measurements
+    */
+    double getMeasureFrameRate() const;
+    /**
+    * @brief Times the serial driver lost bytes because they were not read in time, since connect() or resetStreamCounters()
+    * @details A host that can't keep up with flicker shows up here first
+    * @return -1 if the port can't tell, like a pty or a file
+    */
+    long getOverruns();
+    /**
+    * @brief Bytes thrown away looking for the start of a frame, since connect() or resetStreamCounters()
+    */
+    unsigned long long getBytesDiscarded() const;
+    /**
+    * @brief Whole frames that came back, from the streams and the getNext*() calls
+    */
+    unsigned long getFramesDelivered() const;
+    /**
+    * @brief Frames lost in the bytes that were thrown away, at least one for each gap between good frames
+    */
+    unsigned long getFramesDropped() const;
+    /**
+    * @brief Starts getOverruns(), getBytesDiscarded(), getFramesDelivered() and getFramesDropped() over from 0
+    */
+    void resetStreamCounters();
+    /**
+    * @brief Runs startMeasuring(), startFlicker() and startMeasureCounts() on the reactor's thread,
+    * instead of a thread for this device. Used from the next start.
+    * @details printMeasure(), printFlicker() and printCounts() are called from the reactor's thread,
+    * so a slow one holds up every device on it. Commands sent in between frames hold it up the same way,
+    * that time is not counted against the other devices' timeouts. Ports without a file descriptor still get their own thread.
+    * @param reactor Has to stay around while this is streaming, NULL for its own thread, which is the default
+    * @see KClmtrReactor
+    */
+    void setReactor(KClmtrReactor *reactor);
+    KClmtrReactor *getReactor() const;
     /**
      * @brief Starts the Klein device to measure constantly.
      *
@@ -353,6 +566,42 @@ public:
     * @returns bool isFresh tells weither or not that the Measurement is something the program already grabbed or not
     */
     bool getMeasurement(Measurement &m);
+    /**
+    * @brief Like getMeasurement(), but sleeps until startMeasuring() has one that has not been grabbed yet
+    * @details It wakes up as soon as the measurement comes in, or when the measuring stops
+    * @param m the Measurement struct that will be stored in to
+    * @param timeOut_ms The longest it will wait
+    * @returns false if nothing new came before the time out or the measuring stopped
+    */
+    bool waitForMeasurement(Measurement &m, long timeOut_ms);
+    /**
+    * @brief Takes every measurement from startMeasuring() waiting in the queue, oldest first.
+    * Nothing is missed between calls unless the queue filled up, see setStreamQueueSize()
+    * @param out They are added to the end
+    * @return How many were added
+    */
+    size_t drainMeasurements(std::vector<Measurement> &out);
+    /**
+    * @brief Takes the oldest measurement waiting in the queue
+    * @return false if there was nothing
+    */
+    bool popMeasurement(Measurement &m);
+    /**
+    * @brief Keeps every frame of startMeasuring(), startMeasureCounts() and startFlicker() until it is taken
+    * with drainMeasurements(), drainMeasureCounts(), drainFlickers() or the pop functions
+    * @details Each stream has its own queue of up to frames, they are made here. A frame is copied into its slot,
+    * flicker frames reuse the slot's matrices once it has held one with the same FFT samples, until then they allocate.
+    * The stream never waits on them, when one is full the new frame is dropped and counted in getStreamQueueOverflows().
+    * Only one thread can take from each queue. 0 turns them off, which is the default
+    * @param frames The most each queue holds
+    * @return false if a stream is running, nothing is changed
+    */
+    bool setStreamQueueSize(size_t frames);
+    size_t getStreamQueueSize() const;
+    /**
+    * @brief Frames dropped since setStreamQueueSize() because a queue was full
+    */
+    size_t getStreamQueueOverflows() const;
     /**
      * @brief Returns one measurement from the device. Do not need to startMeasuring() to use this method.
      * @param n Average number of measurements togather to return one measurement\n
@@ -396,6 +645,19 @@ public:
     */
     bool getMeasureCounts(Counts &c);
     /**
+    * @brief Like getMeasureCounts(), but sleeps until startMeasureCounts() has one that has not been grabbed yet
+    * @see waitForMeasurement
+    */
+    bool waitForMeasureCounts(Counts &c, long timeOut_ms);
+    /**
+    * @brief Takes every count from startMeasureCounts() waiting in the queue, oldest first
+    * @see setStreamQueueSize
+    * @param out They are added to the end
+    * @return How many were added
+    */
+    size_t drainMeasureCounts(std::vector<Counts> &out);
+    bool popMeasureCounts(Counts &c);
+    /**
     * @brief Returns one measurement from the device. Do not need to startCount() to use this method.
     * @return Counts
     */
@@ -490,11 +752,41 @@ public:
     * @returns bool isFresh tells weither or not that the flicker is something the program already grabbed or not
     */
     bool getFlicker(Flicker &f);
+    /**
+    * @brief Like getFlicker(), but sleeps until startFlicker() has one that has not been grabbed yet
+    * @see waitForMeasurement
+    */
+    bool waitForFlicker(Flicker &f, long timeOut_ms);
+    /**
+    * @brief Takes every flicker from startFlicker() waiting in the queue, oldest first
+    * @see setStreamQueueSize
+    * @param out They are added to the end
+    * @return How many were added
+    */
+    size_t drainFlickers(std::vector<Flicker> &out);
+    bool popFlicker(Flicker &f);
     /**
      * @brief Grabs and returns one flicker measurement. Do not use startFlicker() method witht his. The speed which this returns is based on the getFFT_Samples()
      * @return Flicker
      */
     Flicker getNextFlicker();
+    /**
+    * @brief Runs the FFT of startFlicker() on a thread of its own, so the port is read while it works
+    * @details The stream only copies the samples of each frame and hands them over. printFlicker() is then called from the FFT thread.
+    * stopFlicker() waits for the frames that were read to be done. Off by default
+    * @param on true to start the thread, false to run the FFT on the stream again
+    * @param skipStale When the FFT falls behind, only the newest samples are used and the older ones are skipped.
+    * Each one holds all of the samples of the ones before it, so only the number of flickers goes down
+    * @return false if a stream is running or it was called from printFlicker(), nothing is changed
+    * @see getFlickerWindowsSkipped
+    */
+    bool setFlickerAnalysisThread(bool on, bool skipStale = true);
+    bool getFlickerAnalysisThread() const;
+    /**
+    * @brief Flicker frames that were read but never went through the FFT, because the FFT thread was behind
+    * @see setFlickerAnalysisThread
+    */
+    unsigned long getFlickerWindowsSkipped() const;
     /**
      * @brief Stops the device from being in flicker mode.
      */
@@ -526,9 +818,11 @@ public:
     * @param portName The name of the port to test
     * @param model If the port is a Klein Device, it will reaturn the Model Number of the device
     * @param SN If the port is a Klein Device, it will reaturn the Serial Number of the device
+    * @param timeOut_ms How long it has from when it is called, 0 uses the commands' own time outs.
+    * Opening the port can't be cut short, a port that is slow to open can still take longer
     * @returns bool it can or cannot be connected
     */
-    static bool testConnection(const std::string &portName, std::string &model, std::string &SN);
+    static bool testConnection(const std::string &portName, std::string &model, std::string &SN, long timeOut_ms = 0);
 
     //Measurement thread
     /**
@@ -561,6 +855,82 @@ public:
     *  @snippet NativeKClmtrExample.cpp flicker
     */
     virtual void printCounts(Counts) {}
+    /**
+    * @brief Calls printMeasure(), printFlicker() and printCounts() from a thread of their own, so a slow one does not hold up the port
+    * @details The stream puts each frame in a queue and goes back to reading. When the queue is full the frame is
+    * not called back and is counted in CallbackStats::dropped, the stream never waits for it.
+    * The other print functions are still called from the stream. 0 calls them from the stream, which is the default.
+    * A class that overrides them should set 0 in its destructor, so nothing is called while it is going away
+    * @param frames The most frames waiting to be called back
+    * @return false if a stream is running or it was called from a callback, nothing is changed
+    */
+    bool setCallbackQueueSize(size_t frames);
+    size_t getCallbackQueueSize() const;
+    /**
+    * @brief How long printMeasure(), printFlicker() and printCounts() waited and ran, since the last setCallbackQueueSize()
+    * @see setCallbackQueueSize
+    */
+    CallbackStats getMeasureCallbackStats() const;
+    CallbackStats getFlickerCallbackStats() const;
+    CallbackStats getCountsCallbackStats() const;
+    /**
+    * @brief Called after a command like setRange() or setAimingLights() was sent in between measurements,
+    * without stopping startMeasuring() or startMeasureCounts()
+    * @details It is called from the measuring thread, you must inherit KClmtr class into your class and then override this function
+    * @param command The command that was sent, like "J1"
+    * @param wait_us How long it waited for its turn, in microseconds
+    */
+    virtual void printQueueWait(const std::string &command, long wait_us) {
+        (void)command;
+        (void)wait_us;
+    }
+    /**
+    * @brief How long the last command sent in between measurements waited for its turn
+    * @see printQueueWait
+    * @return microseconds
+    */
+    long getLastQueueWait() const;
+    /**
+    * @brief How long the last stopMeasuring(), stopFlicker() or stopMeasureCounts() took to stop the stream.
+    * A reply being waited on is cancelled, it does not have to come in or time out first.
+    * @return microseconds
+    */
+    long getLastStopWait() const;
+    /**
+    * @brief How long the last flicker took to get going, from sending T1 or T2 to the first whole frame
+    * @return microseconds
+    */
+    long getLastFlickerStart() const;
+    /**
+    * @brief How long the last flicker took to stop, from sending X9 until the port went quiet and is back to its speed
+    * @return microseconds
+    */
+    long getLastFlickerStop() const;
+    /**
+    * @brief Called when the device goes into or comes out of flicker
+    * @details You must inherit KClmtr class into your class and then override this function
+    * @param flickering true when the first flicker frame came in, false when the flicker stopped
+    * @param switch_us How long the switch took, in microseconds
+    * @see getLastFlickerStart
+    * @see getLastFlickerStop
+    */
+    virtual void printFlickerSwitch(bool flickering, long switch_us) {
+        (void)flickering;
+        (void)switch_us;
+    }
+    /**
+    * @brief Called when a reply was looked for in the connect cache
+    * @details You must inherit KClmtr class into your class and then override this function
+    * @param command The command, like "D7"
+    * @param hit true if it came from the cache
+    * @param saved_us How much time that saved, in microseconds
+    * @see setConnectCache
+    */
+    virtual void printCache(const std::string &command, bool hit, long long saved_us) {
+        (void)command;
+        (void)hit;
+        (void)saved_us;
+    }
 protected:
     struct command {
         const std::string commandString;
@@ -611,6 +981,13 @@ protected:
     */
     unsigned int sendMessageToKColorimeter(const command &m, std::string &readString);
     /**
+    * @brief sendMessageToKColorimeter To send a predefind message, without copying the reply
+    * @param m The message
+    * @param reply The checked frame that came back, good until the next message
+    * @return errorcode
+    */
+    unsigned int sendMessageToKColorimeter(const command &m, Frame &reply);
+    /**
     * @brief sendMessageToKColorimeter To send a string to the device that you don't care about the return
     * @param strMsg The message
     * @param expected The expected number of chars coming back
@@ -627,18 +1004,68 @@ protected:
      * @return errorcode
      */
     unsigned int sendMessageToKColorimeter(const std::string &strMsg, int expected, int timeOut_Sec, std::string &readString);
+    //What came back for one command of a batch
+    struct batchReply {
+        unsigned int error;
+        std::string reply;
+        long long time;	//When the last byte came back, from monotonicMicroseconds()
+
+        batchReply() {
+            error = 0;
+            time = 0;
+        }
+    };
+    /**
+     * @brief sendBatchToKColorimeter To send a few messages in one write
+     * @details The device answers them one after another, so the replies are split up
+     * in order by their expected length, and the whole batch costs one trip over the link.
+     * Only commands with a fixed length reply can go in, nothing that keeps streaming.
+     * Once one of them fails the rest are not read and get the same error.
+     * @param batch The messages, in the order the device gets them
+     * @param replies One for each message
+     * @return errorcode, all of them or'ed together
+     */
+    unsigned int sendBatchToKColorimeter(const std::vector<command> &batch, std::vector<batchReply> &replies);
     /**
-     * @brief readFromKColorimeter To just read from the device
+     * @brief readFromKColorimeter To just read raw bytes from the device
      * @param expected The expected number of chars coming back
      * @param timeOut_Sec the amount of time it should give up
      * @param readString The return message from the device
      * @return errorcode
      */
     unsigned int readFromKColorimeter(int expected, long timeOut_Sec, std::string &readString);
+    /**
+     * @brief readFromKColorimeter To read the next frame of what was last sent, like the next flicker frame
+     * @param timeOut_Sec the amount of time it should give up
+     * @param reply The checked frame, good until the next read
+     * @return errorcode
+     */
+    unsigned int readFromKColorimeter(long timeOut_Sec, Frame &reply);
 private:
     //Objects
+    //The serial port, used unless setTransport() was given something else
     SerialPort m_CommPort;
+    Transport *m_transport;
+    FrameDecoder m_decoder;
+    //Saving everything that goes over m_transport, NULL until the first capture
+    CaptureLog *m_capture;
+    //Replies saved for each device
+    ConnectCache m_connectCache;
+    int m_cacheHits;
+    int m_cacheMisses;
+    long long m_cacheTimeSaved;
+    //True and counted as a hit when the list was saved from before and matches the names in startupString, the P4 reply
+    bool loadCachedCalFileList(const std::string &startupString, std::string &readString);
+    unsigned int fetchAndCache(const command &m, std::string &readString);
     bool m_isOpen;
+    //Rate to talk to the device at, outside of the new flicker
+    int m_baudRate;
+    //Bytes per second of the last reply
+    double m_lastThroughput;
+    void setThroughput(size_t bytes, long long startTime);
+    //How long to wait for each reply
+    AdaptiveTimeout m_timeouts;
+    //The thread running the stream, 0 when there isn't one, under m_threadLock
 #ifdef WIN32
     DWORD threadId;
     HANDLE threadH;
@@ -685,16 +1112,98 @@ private:
     int m_MaxAvgNumber;
     //Speed mode for color measurements
     SpeedMode m_speedMode;
+    //Keeps a N5 in the device while the last one is parsed
+    bool m_measurePipelined;
+    bool m_measureInFlight;
+    unsigned int pipelineMeasurement(Frame &reply);
+    //For the frame rate, under m_threadLock
+    unsigned long m_measureFrames;
+    long long m_firstMeasureTime;
+    long long m_lastMeasureTime;
+    void countMeasureFrame();
+    //Numbers the frames of a stream or a getNext*(), from 1
+    unsigned long m_frameSequence;
+    template<typename Result>
+    void stampFrame(Result &result, const Frame &frame) {
+        result.timestamp = frame.time;
+        result.sequence = ++m_frameSequence;
+        countFrame(frame);
+    }
+    //Lost and delivered frames, see getFramesDropped(). Counted on the stream and read from anywhere, under m_threadLock
+    long m_overrunBase;
+    unsigned long long m_discardedBase;
+    unsigned long long m_discardedSeen;
+    unsigned long m_framesDelivered;
+    unsigned long m_framesDropped;
+    void countFrame(const Frame &frame);
     //Check noise
     bool m_ZeroNoise;
 
-    //Freash Data for Measure and flicker
+    //Freash Data for Measure and flicker, under m_threadLock
     bool m_isFlickerfresh;
     bool m_isMeasurefresh;
     bool m_isCountsfresh;
     Flicker m_flicker;
     Measurement m_measure;
     Counts m_counts;
+    //Every frame of the streams, the stream thread pushes and the user pops
+    SpscQueue<Measurement> m_measureQueue;
+    SpscQueue<Flicker> m_flickerQueue;
+    SpscQueue<Counts> m_countsQueue;
+    //Hands a frame from the stream to the get, waitFor and drain functions and to the print functions
+    void publishMeasure(const Measurement &m);
+    void publishFlicker(const Flicker &f);
+    void publishCounts(const Counts &c);
+    //Returns with m_threadLock held
+    bool waitForFresh(const bool &fresh, long timeOut_ms);
+
+    //The thread from setCallbackQueueSize()
+    struct callbackFrame {
+        int mode;	//_measureMode
+        Measurement measure;
+        Flicker flicker;
+        Counts counts;
+        long long readAt;	//From the frame's timestamp, 0 if it has none
+
+        callbackFrame() {
+            mode = 0;
+            readAt = 0;
+        }
+    };
+    SpscQueue<callbackFrame> m_callbackQueue;
+    callbackFrame m_callbackOut;	//Only the stream uses it
+    callbackFrame m_callbackIn;		//Only the callback thread uses it
+    //Under m_callbackLock
+    bool m_callbackRunning;
+    bool m_callbackStopping;
+    CallbackStats m_callbackStats[3];	//By _measureMode
+#ifdef WIN32
+    mutable CRITICAL_SECTION m_callbackLock;
+    CONDITION_VARIABLE m_callbackChanged;
+    DWORD m_callbackThreadId;
+#else
+    mutable pthread_mutex_t m_callbackLock;
+    pthread_cond_t m_callbackChanged;
+    pthread_t m_callbackThreadId;
+    //For joining, only used by the thread that starts and stops it
+    pthread_t m_callbackThread;
+#endif
+    static void callbackStuff(void *args);
+#ifndef WIN32
+    //pthread_create() wants a function that returns void *
+    static void *callbackEntry(void *args);
+#endif
+    bool startCallbackThread();
+    void stopCallbackThread();
+    bool isCallbackThread() const;
+    void lockCallbacks() const;
+    void unlockCallbacks() const;
+    //m_callbackLock has to be held
+    void waitCallbacks();
+    void signalCallbacks();
+    //Calls the print function now, or has the callback thread call it
+    void queueCallback(int mode, long long readAt);
+    void runCallback(const callbackFrame &frame);
 
 	bool m_DeviceFlickerSpeed;
 
@@ -721,15 +1230,17 @@ private:
     double speedModeMultiplier();
     double multiplierForAveraging();
     int boxCarAvg(double(&data)[3], double(&minMax)[3][2], bool autoAvg, int &error);
-    Measurement parseAndPrintXYZ(std::string ReadString, bool autoAvg = true);
+    Measurement parseAndPrintXYZ(const ByteView &ReadString, bool autoAvg = true);
     double unpackK_float(std::string PartString);
-    double parseK_float(std::string MyString);
+    double parseK_float(const unsigned char *myRead);
     const command &getColorMeasurmentCommand() const;
 
     //CalFiles
     //void reLoadRGB();
     void setCalFileList(const std::string &CalFileList);
     void loadedCalFile(const std::string &CalFileString);
+    //The J commands that get the device to a range, see setRange()
+    static void rangeCommands(int range, std::vector<command> &batch);
     double unpackCalMan_float(std::string PartString);
     void correctXYZCalFile(double inX, double inY, double inZ, double &outX, double &outY, double &outZ);
 
@@ -752,24 +1263,122 @@ private:
     bool isFlickerNew();
     void caluclateCoef(double array[][129]);
     void endFlicker();
+    //Switching into and out of flicker, timed from the commands
+    long long m_flickerStartAt;
+    long long m_flickerStopAt;		//0 once the port has gone quiet
+    bool m_flickerLastX9;			//The old firmware's third X9 goes out once it is quiet
+    long m_flickerQuiet_us;
+    long m_lastFlickerStart;
+    long m_lastFlickerStop;
+    void finishFlickerStop();
+    long flickerQuietTime(int speed) const;
+    void flickerFrameArrived(const Frame &frame);
 
     //FFT - Parsing
-    Flicker parseAndPrintFFT(std::string &read);
+    //Everything from one frame the FFT needs, so it can be done on another thread
+    struct flickerWindow {
+        FlickerSetting settings;
+        std::vector<double> samples;	//Empty if there was nothing to work on
+        int count;
+        double bigY;
+        MeasurementRange range;
+        unsigned int errorcode;
+        long long timestamp;
+        unsigned long sequence;
+
+        flickerWindow() {
+            count = 0;
+            bigY = 0;
+            range = MeasurementRange::range1;
+            errorcode = 0;
+            timestamp = 0;
+            sequence = 0;
+        }
+    };
+    //The cheap part, it has to keep up with the port
+    void parseFlickerWindow(const ByteView &read, flickerWindow &window);
+    //The FFT
+    static Flicker analyzeFlickerWindow(const flickerWindow &window);
+    static bool isFlickerStopError(unsigned int error);
+    flickerWindow m_flickerWindowOut;	//Only the stream uses it
+    flickerWindow m_flickerWindowIn;	//Only the FFT thread uses it
+    SpscQueue<flickerWindow> m_flickerWindows;
+    //Under m_threadLock
+    bool m_analysisRunning;
+    bool m_analysisStopping;
+    bool m_analysisBusy;
+    bool m_skipStaleWindows;
+    unsigned long m_flickerWindowsSkipped;
+#ifdef WIN32
+    DWORD m_analysisThreadId;
+#else
+    pthread_t m_analysisThreadId;
+    //For joining, only used by the thread that starts and stops it
+    pthread_t m_analysisThread;
+#endif
+    static void analysisStuff(void *args);
+#ifndef WIN32
+    static void *analysisEntry(void *args);
+#endif
+    bool startAnalysisThread();
+    void stopAnalysisThread();
+    bool isAnalysisThread() const;
+    //Sleeps until every window that was handed over is done
+    void waitForFlickerAnalysis();
+    //Runs the FFT now, or hands it to the FFT thread
+    void queueFlickerWindow(const flickerWindow &window);
     void resetFlicker();
-    bool verify_FFTString(const std::string &FFTString);
-    unsigned int parseSignal_from_FFT_str(const std::string &FFTString);
-    unsigned int parseN5Command(const std::string &FFTString, double &outX, double &outY, double &outZ, MeasurementRange &outRange);
+    unsigned int parseSignal_from_FFT_str(const ByteView &FFTString);
+    unsigned int parseN5Command(const ByteView &FFTString, double &outX, double &outY, double &outZ, MeasurementRange &outRange);
     int startFlicker(bool grabConstanly);
 
 
     //Sending/Receiving
-    static unsigned int sendMessageToSerialPort(SerialPort &comPort, const command &m, std::string &readString);
-    static unsigned int sendMessageToSerialPort(SerialPort &comPort, const std::string &strMsg, int expected, int timeOut_Sec, std::string &readString);
-    static unsigned int readFromSerialPort(SerialPort &comPort, int expected, long timeOut_Sec, std::string &readString);
+    static unsigned int sendMessageToSerialPort(Transport &comPort, FrameDecoder &decoder, const command &m, std::string &readString);
+    //With a timer, it learns how long each command takes and waits only that long.
+    //A limit from monotonicMicroseconds() is never waited past, whatever the time out, 0 for none
+    static unsigned int sendMessageToSerialPort(Transport &comPort, FrameDecoder &decoder, const std::string &strMsg, int expected, int timeOut_Sec, std::string &readString, AdaptiveTimeout *timer = NULL, long long limit = 0);
+    static unsigned int sendMessageToSerialPort(Transport &comPort, FrameDecoder &decoder, const std::string &strMsg, int expected, int timeOut_Sec, Frame &reply, AdaptiveTimeout *timer = NULL, long long limit = 0);
+    static unsigned int readFromSerialPort(Transport &comPort, FrameDecoder &decoder, long timeOut_Sec, Frame &reply, AdaptiveTimeout *timer = NULL, long long limit = 0);
+    static unsigned int sendBatchToSerialPort(Transport &comPort, FrameDecoder &decoder, const std::vector<command> &batch, std::vector<batchReply> &replies, AdaptiveTimeout *timer = NULL);
+    static void writeToSerialPort(Transport &comPort, const std::string &strMsg);
+    void stopStreamingFor(const std::string &strMsg, int expected);
+
+    //Commands sent between frames while measuring, instead of stopping
+    struct queuedCommand {
+        std::string commandString;
+        int expected;
+        int timeout;
+        int priority;
+        long long queuedAt;
+        bool done;	//Under m_threadLock, the caller sleeps on m_threadChanged until it is set
+        unsigned int error;
+        std::string reply;
+    };
+    //Highest priority first, then oldest first
+    std::vector<queuedCommand *> m_commandQueue;
+#ifdef WIN32
+    CRITICAL_SECTION m_queueLock;
+#else
+    pthread_mutex_t m_queueLock;
+#endif
+    long m_lastQueueWait;
+    long m_lastStopWait;
+    //A stream was stopped before its last reply came in, the next command waits this long for it
+    long long m_drainUntil;
+    void drainCancelledReply();
+    void lockQueue();
+    void unlockQueue();
+    bool isStreamThread() const;
+    bool isQueueable(const std::string &strMsg, int expected) const;
+    static int commandPriority(const std::string &strMsg);
+    bool hasQueuedCommands();
+    unsigned int queueCommand(const std::string &strMsg, int expected, int timeOut_Sec, std::string &readString);
+    void serviceCommandQueue();
 
     //Setup/Close
     static bool setSerialNumberValues(const std::string &read, std::string &model, std::string &SN);
-    static bool getModelSN(SerialPort &comPort, std::string &model, std::string &SN);
+    static bool getModelSN(Transport &comPort, std::string &model, std::string &SN, long long limit = 0);
 
     //Measurement thread
     enum _ThreadMode {
@@ -786,8 +1395,52 @@ private:
     void stopThread2();
     void endThread();
     static void threadStuff(void *args);
+#ifndef WIN32
+    static void *threadEntry(void *args);
+#endif
+    //One frame of the stream, the thread and the reactor both use these
+    void beginStream();
+    unsigned int readStreamFrame(Frame &frame);
+    void handleStreamFrame(unsigned int error, const Frame &frame);
+    //The reactor's side, nothing here blocks waiting on the device
+    KClmtrReactor *m_reactor;
+    //The one running the stream now, NULL on its own thread
+    KClmtrReactor *m_streamReactor;
+    long long m_streamDeadline;
+    void requestStreamFrame();
+    void pollStream();
+    void checkStreamDeadline(long long now);
+    //Shared with the stream thread, so they are only used through parentMode(), setParentMode(),
+    //childMode() and setChildMode() under m_threadLock
     _ThreadMode threadModeParent;
     _ThreadMode threadModeChild;
+    //Goes up each time a stream gets going, so a start that stopped right away can't be missed
+    unsigned long m_childStarts;
+#ifdef WIN32
+    mutable CRITICAL_SECTION m_threadLock;
+    CONDITION_VARIABLE m_threadChanged;
+#else
+    mutable pthread_mutex_t m_threadLock;
+    pthread_cond_t m_threadChanged;
+    //The thread from startThread2(), until it is joined
+    pthread_t m_streamThread;
+    bool m_streamJoinable;
+#endif
+    void lockThread() const;
+    void unlockThread() const;
+    //Sleeps until something under m_threadLock changes, it has to be held
+    void waitThread();
+    //The same, but gives up at deadline from monotonicMicroseconds(), false once it has passed
+    bool waitThreadUntil(long long deadline);
+    //Wakes everything in waitThread(), it has to be held
+    void signalThread();
+    _ThreadMode parentMode() const;
+    _ThreadMode childMode() const;
+    void setParentMode(_ThreadMode mode);
+    void setChildMode(_ThreadMode mode);
+    //Sleeps until the stream is gone
+    void waitForChildStop();
+    void joinStreamThread();
     _measureMode measureMode;
     void stopFlicker2();
     void stopMeasuring2();
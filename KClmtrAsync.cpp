@@ -0,0 +1,127 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "KClmtrAsync.h"
+
+using namespace std;
+using namespace KClmtrBase::KClmtrNative;
+
+KClmtrAsync::KClmtrAsync(KClmtr &kclmtr) : m_kclmtr(kclmtr) {
+    m_stopping = false;
+    m_thread = thread(&KClmtrAsync::run, this);
+}
+KClmtrAsync::~KClmtrAsync() {
+    {
+        lock_guard<mutex> guard(m_lock);
+        m_stopping = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+void KClmtrAsync::post(const function<void()> &job) {
+    {
+        lock_guard<mutex> guard(m_lock);
+        m_jobs.push_back(job);
+    }
+    m_wake.notify_one();
+}
+size_t KClmtrAsync::pending() {
+    lock_guard<mutex> guard(m_lock);
+    return m_jobs.size();
+}
+void KClmtrAsync::run() {
+    for(;;) {
+        function<void()> job;
+        {
+            unique_lock<mutex> guard(m_lock);
+            while(m_jobs.empty() && !m_stopping) {
+                m_wake.wait(guard);
+            }
+            //Everything that was given still gets done
+            if(m_jobs.empty()) {
+                return;
+            }
+            job = m_jobs.front();
+            m_jobs.pop_front();
+        }
+        job();
+    }
+}
+
+future<AsyncReply> KClmtrAsync::sendMessage(const string &strMsg, int expected, int timeOut_Sec) {
+    return submit([strMsg, expected, timeOut_Sec](KClmtr & k) {
+        AsyncReply r;
+        r.errorcode = k.sendMessageToKColorimeter(strMsg, expected, timeOut_Sec, r.reply);
+        return r;
+    });
+}
+future<bool> KClmtrAsync::connect() {
+    return submit([](KClmtr & k) {
+        return k.connect();
+    });
+}
+future<Measurement> KClmtrAsync::getNextMeasurement(int n) {
+    return submit([n](KClmtr & k) {
+        return k.getNextMeasurement(n);
+    });
+}
+future<Counts> KClmtrAsync::getNextMeasureCount() {
+    return submit([](KClmtr & k) {
+        return k.getNextMeasureCount();
+    });
+}
+future<Flicker> KClmtrAsync::getNextFlicker() {
+    return submit([](KClmtr & k) {
+        return k.getNextFlicker();
+    });
+}
+future<BlackMatrix> KClmtrAsync::captureBlackLevel() {
+    return submit([](KClmtr & k) {
+        return k.captureBlackLevel();
+    });
+}
+future<BlackMatrix> KClmtrAsync::getFlashMatrix() {
+    return submit([](KClmtr & k) {
+        return k.getFlashMatrix();
+    });
+}
+future<BlackMatrix> KClmtrAsync::getRAMMatrix() {
+    return submit([](KClmtr & k) {
+        return k.getRAMMatrix();
+    });
+}
+future<BlackMatrix> KClmtrAsync::getCoefficientMatrix() {
+    return submit([](KClmtr & k) {
+        return k.getCoefficientMatrix();
+    });
+}
+future<void> KClmtrAsync::setCalFileID(int calFileID) {
+    return submit([calFileID](KClmtr & k) {
+        k.setCalFileID(calFileID);
+    });
+}
+future<int> KClmtrAsync::deleteCalFile(int calFileID) {
+    return submit([calFileID](KClmtr & k) {
+        return k.deleteCalFile(calFileID);
+    });
+}
@@ -0,0 +1,131 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include "KClmtr.h"
+
+namespace KClmtrBase {
+namespace KClmtrNative {
+/**
+ * @brief What came back from an asynchronous sendMessage()
+ */
+struct AsyncReply {
+    unsigned int errorcode;	/**< errorcode from KleinsErrorCodes */
+    std::string reply;		/**< The return message from the device */
+
+    AsyncReply() {
+        errorcode = 0;
+    }
+};
+
+/**
+ * @brief Runs KClmtr commands on its own I/O thread, handing back a std::future for each one
+ * @details Commands are run one at a time, in the order they were given, so the serial port only
+ * has one user. While a KClmtrAsync is running, only use the KClmtr through it, or from the
+ * KClmtr's own callbacks. Destroying it finishes every command that was already given.
+ */
+class KClmtrAsync {
+public:
+    /**
+     * @brief Starts the I/O thread
+     * @param kclmtr The device to run commands on, it must outlive this object
+     */
+    explicit KClmtrAsync(KClmtr &kclmtr);
+    ~KClmtrAsync();
+
+    /**
+     * @brief Runs anything on the I/O thread
+     * @param work Called with the KClmtr, what it returns goes into the future
+     * @return The future for what work returns
+     */
+    template<typename Work>
+    auto submit(Work work) -> std::future<decltype(work(std::declval<KClmtr &>()))> {
+        //Not std::result_of, it is gone in C++20
+        typedef decltype(work(std::declval<KClmtr &>())) Result;
+        std::shared_ptr<std::packaged_task<Result()> > task(
+            new std::packaged_task<Result()>(std::bind(work, std::ref(m_kclmtr))));
+        std::future<Result> result = task->get_future();
+        post([task]() {
+            (*task)();
+        });
+        return result;
+    }
+    /**
+     * @brief Runs anything on the I/O thread, then calls done on the I/O thread with what it returned
+     * @param work Called with the KClmtr
+     * @param done Called with the result, it should not block for long
+     */
+    template<typename Work, typename Done>
+    void submit(Work work, Done done) {
+        KClmtr &kclmtr = m_kclmtr;
+        post([work, done, &kclmtr]() {
+            done(work(kclmtr));
+        });
+    }
+
+    /**
+     * @brief sendMessageToKColorimeter() on the I/O thread
+     * @param strMsg The message
+     * @param expected The expected number of chars coming back
+     * @param timeOut_Sec the amount of time it should give up
+     */
+    std::future<AsyncReply> sendMessage(const std::string &strMsg, int expected, int timeOut_Sec);
+    std::future<bool> connect();
+    std::future<Measurement> getNextMeasurement(int n = -1);
+    std::future<Counts> getNextMeasureCount();
+    std::future<Flicker> getNextFlicker();
+    std::future<BlackMatrix> captureBlackLevel();
+    std::future<BlackMatrix> getFlashMatrix();
+    std::future<BlackMatrix> getRAMMatrix();
+    std::future<BlackMatrix> getCoefficientMatrix();
+    std::future<void> setCalFileID(int calFileID);
+    std::future<int> deleteCalFile(int calFileID);
+
+    /**
+     * @brief The number of commands waiting for the I/O thread, not counting the one running
+     */
+    size_t pending();
+private:
+    KClmtrAsync(const KClmtrAsync &);
+    KClmtrAsync &operator=(const KClmtrAsync &);
+
+    void post(const std::function<void()> &job);
+    void run();
+
+    KClmtr &m_kclmtr;
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::deque<std::function<void()> > m_jobs;
+    bool m_stopping;
+    std::thread m_thread;
+};
+}
+}
@@ -0,0 +1,95 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "KClmtrDiscovery.h"
+#include "KClmtr.h"
+#include <thread>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <glob.h>
+#endif
+
+using namespace std;
+using namespace KClmtrBase::KClmtrNative;
+
+vector<string> KClmtrDiscovery::candidatePorts() {
+    vector<string> ports;
+#ifdef WIN32
+    char target[512];
+    for(int i = 1; i <= 256; ++i) {
+        string name = "COM" + to_string(i);
+        if(QueryDosDeviceA(name.c_str(), target, sizeof(target)) != 0) {
+            //COM10 and up only open with the long name
+            ports.push_back(i < 10 ? name : "\\\\.\\" + name);
+        }
+    }
+#else
+    static const char *patterns[] = {
+        "/dev/ttyUSB*",			//FTDI and other USB serial in Linux
+        "/dev/ttyACM*",			//USB modems in Linux
+        "/dev/cu.usbserial*",	//FTDI in Mac
+        "/dev/cu.usbmodem*"		//USB modems in Mac
+    };
+    for(size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); ++i) {
+        glob_t found;
+        if(glob(patterns[i], 0, NULL, &found) == 0) {
+            for(size_t j = 0; j < found.gl_pathc; ++j) {
+                ports.push_back(found.gl_pathv[j]);
+            }
+        }
+        globfree(&found);
+    }
+#endif
+    return ports;
+}
+vector<DiscoveredDevice> KClmtrDiscovery::discover(long timeOut_ms) {
+    return discover(candidatePorts(), timeOut_ms);
+}
+vector<DiscoveredDevice> KClmtrDiscovery::discover(const vector<string> &ports, long timeOut_ms) {
+    vector<DiscoveredDevice> probed(ports.size());
+    //Not vector<bool>, each thread writes its own and those share bytes
+    vector<char> found(ports.size(), 0);
+    vector<thread> threads;
+    threads.reserve(ports.size());
+
+    //Each probe gives up on its own by then, so all of them can be waited for
+    for(size_t i = 0; i < ports.size(); ++i) {
+        probed[i].portName = ports[i];
+        threads.push_back(thread([&probed, &found, i, timeOut_ms]() {
+            DiscoveredDevice &device = probed[i];
+            found[i] = KClmtr::testConnection(device.portName, device.model, device.serialNumber, timeOut_ms);
+        }));
+    }
+    for(size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+
+    vector<DiscoveredDevice> devices;
+    for(size_t i = 0; i < ports.size(); ++i) {
+        if(found[i]) {
+            devices.push_back(probed[i]);
+        }
+    }
+    return devices;
+}
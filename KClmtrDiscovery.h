@@ -0,0 +1,68 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#include <string>
+#include <vector>
+
+namespace KClmtrBase {
+namespace KClmtrNative {
+/**
+ * @brief A Klein device found by KClmtrDiscovery
+ */
+struct DiscoveredDevice {
+    std::string portName;		/**< The port to connect() to */
+    std::string model;			/**< Model Number of the device */
+    std::string serialNumber;	/**< Serial Number of the device */
+};
+
+/**
+ * @brief Finds every Klein device plugged in, asking all of the ports at the same time
+ * @details Each port is tried with KClmtr::testConnection() on its own thread, so finding
+ * them takes about as long as the slowest port and not all of them added up.
+ * Every probe stops waiting for its port at the deadline, and is finished before discover() returns,
+ * so a port that has not answered is left out and is closed again. Only opening a port can't be cut short.
+ */
+class KClmtrDiscovery {
+public:
+    /**
+     * @brief The ports a Klein device could be on, the USB serial ports in Linux and Mac,
+     * and the COM ports that are there in Windows
+     */
+    static std::vector<std::string> candidatePorts();
+    /**
+     * @brief Tries all of candidatePorts()
+     * @param timeOut_ms How long each port has to answer, they are all tried at once
+     * @return Every Klein device that answered, in the order of the ports
+     */
+    static std::vector<DiscoveredDevice> discover(long timeOut_ms = 2000);
+    /**
+     * @brief Tries the ports given
+     * @param ports Like "/dev/ttyUSB0" or "COM3"
+     * @param timeOut_ms How long each port has to answer, they are all tried at once
+     * @return Every Klein device that answered, in the order of the ports
+     */
+    static std::vector<DiscoveredDevice> discover(const std::vector<std::string> &ports, long timeOut_ms = 2000);
+};
+}
+}
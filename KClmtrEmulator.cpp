@@ -0,0 +1,588 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "KClmtrEmulator.h"
+#include "Timing.h"
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+
+using namespace std;
+using namespace KClmtrBase::KClmtrNative;
+
+//The device goes to 19200 by itself for T1
+static const int flickerBaudRate = 19200;
+//Samples in a flicker frame
+static const int samplesPerFrame = 32;
+//Average of the flicker samples, saturation is at 61000
+static const double flickerCounts = 20000;
+//Longest wait before checking for commands again
+static const long maxWait_us = 10000;
+
+static const double pi = 3.14159265358979323846;
+
+static string padded(const string &s, size_t length) {
+    string out = s.substr(0, length);
+    out.append(length - out.size(), ' ');
+    return out;
+}
+static double sensorGain(double frequency) {
+    //The sensor falls off with frequency, the flicker cal in P4 brings it back up
+    return 1 + pow((frequency - 1) / 15, 2);
+}
+static void appendWord(string &s, int v) {
+    //Big endian, 2's complement for negatives
+    unsigned int w = (unsigned int)v & 0xffff;
+    s += (char)(w >> 8);
+    s += (char)(w & 0xff);
+}
+
+KClmtrEmulator::KClmtrEmulator() {
+    m_running = false;
+
+    m_baudRate = 9600;
+    m_commandDelay = 2000;
+    m_realTime = true;
+
+    m_model = "K-10-A";
+    m_serialNumber = "EMU000001";
+    m_firmware = "01.10fh";
+    for(int i = 1; i < 97; ++i) {
+        m_calFiles[i] = string(128, (char)255);
+    }
+    double identity[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+    setCalFile(1, "Emulated Display", identity);
+    for(int i = 0; i < 18; ++i) {
+        //Higher ranges have less dark current
+        m_blackRAM[i] = 1500 - (i / 3) * 150 + (i % 3) * 10;
+        m_blackFlash[i] = m_blackRAM[i];
+    }
+    m_blackRAM[18] = m_blackFlash[18] = 1200;
+    m_range = 3;
+    m_autoRange = true;
+    m_aimingLights = false;
+
+    //D65 at 100 nits
+    m_xyz[0] = 95.047;
+    m_xyz[1] = 100.0;
+    m_xyz[2] = 108.883;
+    m_flickerFrequency = 30;
+    m_flickerPercent = 10;
+
+    m_inputState = COMMAND;
+    m_outputSent = 0;
+    m_wireFreeAt = 0;
+    m_busyUntil = 0;
+    m_streaming = false;
+    m_fastFlicker = false;
+    m_nextFrameAt = 0;
+    m_sample = 0;
+    m_commandCount = 0;
+    m_frameCount = 0;
+}
+KClmtrEmulator::~KClmtrEmulator() {
+    stop();
+    close();
+}
+bool KClmtrEmulator::open() {
+    return m_port.openPort();
+}
+void KClmtrEmulator::close() {
+    stop();
+    m_port.closePort();
+}
+string KClmtrEmulator::slaveName() const {
+    return m_port.slaveName();
+}
+void KClmtrEmulator::start() {
+    if(m_thread.joinable()) {
+        return;
+    }
+    m_running = true;
+    m_thread = thread(&KClmtrEmulator::run, this);
+}
+void KClmtrEmulator::stop() {
+    m_running = false;
+    if(m_thread.joinable() && m_thread.get_id() != this_thread::get_id()) {
+        m_thread.join();
+    }
+}
+bool KClmtrEmulator::isRunning() const {
+    return m_running;
+}
+void KClmtrEmulator::run() {
+    m_running = true;
+    while(m_running && m_port.isOpen()) {
+        long long now = monotonicMicroseconds();
+        long wait_us;
+        {
+            lock_guard<mutex> guard(m_lock);
+            if(m_streaming) {
+                queueFlickerFrame(now);
+            }
+            wait_us = flush(now);
+            if(m_streaming && m_realTime) {
+                long untilFrame = (long)(m_nextFrameAt - now);
+                if(untilFrame < wait_us) {
+                    wait_us = untilFrame < 0 ? 0 : untilFrame;
+                }
+            }
+        }
+        //Waking up for the next command, or when there is something to send
+        RingBuffer &received = m_port.receiveBuffer();
+        m_port.receive((int)received.size() + 1, (wait_us + 999) / 1000);
+        if(!received.empty()) {
+            string bytes = m_port.readExisting();
+            lock_guard<mutex> guard(m_lock);
+            m_input += bytes;
+            handleInput(monotonicMicroseconds());
+        }
+    }
+    m_running = false;
+}
+
+//Timing
+void KClmtrEmulator::setBaudRate(int speed) {
+    lock_guard<mutex> guard(m_lock);
+    m_baudRate = speed < 0 ? 0 : speed;
+}
+int KClmtrEmulator::getBaudRate() const {
+    lock_guard<mutex> guard(m_lock);
+    return m_baudRate;
+}
+void KClmtrEmulator::setCommandDelay(long delay_us) {
+    lock_guard<mutex> guard(m_lock);
+    m_commandDelay = delay_us < 0 ? 0 : delay_us;
+}
+long KClmtrEmulator::getCommandDelay() const {
+    lock_guard<mutex> guard(m_lock);
+    return m_commandDelay;
+}
+void KClmtrEmulator::setRealTime(bool realTime) {
+    lock_guard<mutex> guard(m_lock);
+    m_realTime = realTime;
+}
+bool KClmtrEmulator::getRealTime() const {
+    lock_guard<mutex> guard(m_lock);
+    return m_realTime;
+}
+void KClmtrEmulator::setFastAsPossible() {
+    lock_guard<mutex> guard(m_lock);
+    m_baudRate = 0;
+    m_commandDelay = 0;
+    m_realTime = false;
+}
+
+//What it is
+void KClmtrEmulator::setModel(const string &model, const string &serialNumber) {
+    lock_guard<mutex> guard(m_lock);
+    m_model = model;
+    m_serialNumber = serialNumber;
+}
+void KClmtrEmulator::setFirmware(const string &firmware) {
+    lock_guard<mutex> guard(m_lock);
+    m_firmware = firmware;
+}
+void KClmtrEmulator::setCalFile(int id, const string &name, const double matrix[9]) {
+    if(id < 1 || id > 96) {
+        return;
+    }
+    //Packed the same as KClmtr::packUserMatrix()
+    string calFile(128, '\0');
+    memcpy(&calFile[0], padded(name, 20).c_str(), 20);
+    calFile[20] = '/';
+    calFile[21] = '/';
+    const double whiteSpec[5] = {95.043, 100.000, 108.890, 0.005, 5.00};
+    for(int i = 0; i < 5; ++i) {
+        packK_float(whiteSpec[i], false, (unsigned char *)&calFile[59 + i * 3]);
+    }
+    for(int i = 0; i < 9; ++i) {
+        packK_float(i % 4 == 0 ? 1 : 0, false, (unsigned char *)&calFile[74 + i * 3]);
+        packK_float(matrix[i], false, (unsigned char *)&calFile[101 + i * 3]);
+    }
+    lock_guard<mutex> guard(m_lock);
+    m_calFiles[id] = calFile;
+}
+void KClmtrEmulator::setXYZ(double bigX, double bigY, double bigZ) {
+    lock_guard<mutex> guard(m_lock);
+    m_xyz[0] = bigX;
+    m_xyz[1] = bigY;
+    m_xyz[2] = bigZ;
+}
+void KClmtrEmulator::setFlicker(double frequency, double percent) {
+    lock_guard<mutex> guard(m_lock);
+    m_flickerFrequency = frequency;
+    m_flickerPercent = percent;
+}
+unsigned long long KClmtrEmulator::getCommandCount() const {
+    lock_guard<mutex> guard(m_lock);
+    return m_commandCount;
+}
+unsigned long long KClmtrEmulator::getFrameCount() const {
+    lock_guard<mutex> guard(m_lock);
+    return m_frameCount;
+}
+void KClmtrEmulator::packK_float(double v, bool measurement, unsigned char out[3]) {
+    //Sign bit, a 15 bit fraction where 10000000 00000000 is .5, and a signed 2's exponent
+    out[0] = out[1] = out[2] = 0;
+    if(v == 0) {
+        return;
+    }
+    bool negative = v < 0;
+    int exponent;
+    double fraction = frexp(fabs(v), &exponent);
+    long bits = (long)(fraction * 32768 + 0.5);
+    if(bits >= 32768) {
+        bits /= 2;
+        ++exponent;
+    }
+    if(measurement) {
+        //KClmtr::parseK_float() divides by 65536 and not 32768
+        ++exponent;
+    }
+    out[0] = (unsigned char)((bits >> 8) | (negative ? 0x80 : 0));
+    out[1] = (unsigned char)(bits & 0xff);
+    out[2] = (unsigned char)(signed char)exponent;
+}
+
+//The conversation
+void KClmtrEmulator::handleInput(long long now) {
+    while(!m_input.empty()) {
+        if(m_inputState == CALFILE_INDEX) {
+            //The index can be anything, even \r
+            if(m_input.size() < 2) {
+                return;
+            }
+            int id = (unsigned char)m_input[0];
+            m_input.erase(0, 2);
+            m_inputState = COMMAND;
+            ++m_commandCount;
+            queueReply(calFile(id) + "<0>", schedule(now, 0));
+            continue;
+        }
+        if(m_inputState == CALFILE_STORE) {
+            if(m_input.size() < 135) {
+                return;
+            }
+            string stored = m_input.substr(0, 135);
+            m_input.erase(0, 135);
+            m_inputState = COMMAND;
+            ++m_commandCount;
+            int id = (unsigned char)stored[3];
+            if(stored.compare(0, 3, "MAT") != 0 || stored[4] != '(' || stored[133] != ')' ||
+                    id < 1 || id > 96) {
+                queueReply("<e>", schedule(now, 0));
+            } else {
+                m_calFiles[id] = stored.substr(5, 128);
+                //Writing the flash
+                queueReply("<0>", schedule(now, 50000));
+            }
+            continue;
+        }
+        size_t end = m_input.find('\r');
+        if(end == string::npos) {
+            return;
+        }
+        string commandString = m_input.substr(0, end);
+        m_input.erase(0, end + 1);
+        if(commandString.empty()) {
+            continue;
+        }
+        if(m_inputState == BLACKCAL_PASSWORD) {
+            m_inputState = COMMAND;
+            ++m_commandCount;
+            if(commandString == "{00000000}@%#") {
+                memcpy(m_blackFlash, m_blackRAM, sizeof(m_blackFlash));
+                queueReply("<0>", schedule(now, 50000));
+            } else {
+                queueReply("<e>", schedule(now, 0));
+            }
+            continue;
+        }
+        handleCommand(commandString, now);
+    }
+}
+void KClmtrEmulator::handleCommand(const string &commandString, long long now) {
+    ++m_commandCount;
+    if(commandString == "X9") {
+        //Stops the flicker, the frames not started yet never go out
+        if(m_streaming) {
+            m_streaming = false;
+            while(m_output.size() > (m_outputSent > 0 ? 1u : 0u)) {
+                m_output.pop_back();
+            }
+        }
+        return;
+    }
+    if(m_streaming) {
+        //Nothing else is heard while flickering
+        return;
+    }
+    if(commandString == "P0") {
+        queueReply(deviceInfo(), schedule(now, 0));
+    } else if(commandString == "P4") {
+        queueReply(flickerInfo(), schedule(now, 0));
+    } else if(commandString == "D7") {
+        queueReply(calFileList(), schedule(now, 0));
+    } else if(commandString == "D1") {
+        m_inputState = CALFILE_INDEX;
+        queueReply("D1", schedule(now, 0));
+    } else if(commandString == "D9") {
+        m_inputState = CALFILE_STORE;
+        queueReply("D9", schedule(now, 0));
+    } else if(commandString == "B7") {
+        m_inputState = BLACKCAL_PASSWORD;
+        queueReply("B7", schedule(now, 0));
+    } else if(commandString == "N4") {
+        queueReply(colorReply(commandString), schedule(now, 1000000 / 16));
+    } else if(commandString == "N5") {
+        queueReply(colorReply(commandString), schedule(now, 1000000 / 8));
+    } else if(commandString == "N6") {
+        queueReply(colorReply(commandString), schedule(now, 1000000 / 4));
+    } else if(commandString == "N7") {
+        queueReply(colorReply(commandString), schedule(now, 1000000 / 2));
+    } else if(commandString == "M6") {
+        queueReply(countsReply(), schedule(now, 1000000 / 4));
+    } else if(commandString == "T1" || commandString == "T2") {
+        m_streaming = true;
+        m_fastFlicker = commandString == "T1";
+        m_nextFrameAt = schedule(now, 0);
+    } else if(commandString == "B4") {
+        queueReply(blackReply(commandString, m_blackRAM), schedule(now, 0));
+    } else if(commandString == "B8") {
+        queueReply(blackReply(commandString, m_blackFlash), schedule(now, 0));
+    } else if(commandString == "B9") {
+        //A new black cal into RAM, the sensor has warmed up a little since the last one
+        for(int i = 0; i < 18; ++i) {
+            m_blackRAM[i] = m_blackFlash[i] + 5;
+        }
+        m_blackRAM[18] = m_blackFlash[18] + 20;
+        queueReply(blackReply(commandString, m_blackRAM), schedule(now, 4000000));
+    } else if(commandString == "S0") {
+        queueReply(coefficientReply(), schedule(now, 0));
+    } else if(commandString.size() == 2 && commandString[0] == 'J' &&
+              commandString[1] >= '1' && commandString[1] <= '8') {
+        int j = commandString[1] - '0';
+        if(j <= 6) {
+            m_range = j;
+            m_autoRange = false;
+        } else {
+            m_autoRange = j == 8;
+        }
+        queueReply(string(1, '0'), schedule(now, 0));
+    } else if(commandString == "L0" || commandString == "L1") {
+        m_aimingLights = commandString == "L1";
+    }
+}
+long long KClmtrEmulator::schedule(long long now, long work_us) {
+    //One command at a time, in the order they came
+    long long start = now > m_busyUntil ? now : m_busyUntil;
+    m_busyUntil = start + m_commandDelay + (m_realTime ? work_us : 0);
+    return m_busyUntil;
+}
+void KClmtrEmulator::queueReply(const string &bytes, long long readyAt) {
+    pendingReply reply;
+    reply.readyAt = readyAt;
+    reply.bytes = bytes;
+    m_output.push_back(reply);
+}
+void KClmtrEmulator::queueFlickerFrame(long long now) {
+    if(m_realTime) {
+        //One frame every 32 samples
+        long period = samplesPerFrame * 1000000L / (m_fastFlicker ? 384 : 256);
+        while(m_nextFrameAt <= now) {
+            queueReply(flickerFrame(), m_nextFrameAt + period);
+            m_nextFrameAt += period;
+        }
+    } else if(m_output.empty()) {
+        //As fast as the host takes them
+        queueReply(flickerFrame(), now);
+    }
+}
+long KClmtrEmulator::flush(long long now) {
+    int speed = wireSpeed();
+    //10 bits a byte, with the start and stop bits
+    double byteTime = speed > 0 ? 10000000.0 / speed : 0;
+    while(!m_output.empty()) {
+        pendingReply &reply = m_output.front();
+        if(reply.readyAt > now) {
+            long wait = (long)(reply.readyAt - now);
+            return wait < maxWait_us ? wait : maxWait_us;
+        }
+        size_t n = reply.bytes.size() - m_outputSent;
+        if(byteTime > 0) {
+            if(m_wireFreeAt < reply.readyAt) {
+                m_wireFreeAt = reply.readyAt;
+            }
+            //Only the bytes that would have made it over the wire by now
+            long long onWire = (long long)((now - m_wireFreeAt) / byteTime);
+            if(onWire <= 0) {
+                return (long)byteTime + 1;
+            }
+            if((long long)n > onWire) {
+                n = (size_t)onWire;
+            }
+        }
+        int written = m_port.writePort((const unsigned char *)reply.bytes.data() + m_outputSent, n);
+        if(written < 0) {
+            if(errno == EAGAIN || errno == EINTR) {
+                //The host is not keeping up
+                return 1000;
+            }
+            //Nobody on the other end, what was said is lost
+            m_output.clear();
+            m_outputSent = 0;
+            break;
+        }
+        m_outputSent += written;
+        m_wireFreeAt += (long long)(written * byteTime);
+        if(m_outputSent < reply.bytes.size()) {
+            return byteTime > 0 ? (long)byteTime + 1 : 1000;
+        }
+        m_output.pop_front();
+        m_outputSent = 0;
+    }
+    return maxWait_us;
+}
+int KClmtrEmulator::wireSpeed() const {
+    if(m_baudRate > 0 && m_streaming && m_fastFlicker) {
+        return flickerBaudRate;
+    }
+    return m_baudRate;
+}
+
+//The replies
+string KClmtrEmulator::deviceInfo() const {
+    //P0, 7 bytes of model, 9 bytes of serial number, <0>
+    return "P0" + padded(m_model, 7) + padded(m_serialNumber, 9) + "<0>";
+}
+string KClmtrEmulator::flickerInfo() const {
+    //P4, model/sn 16, firmware 8, fft matrices 128 * 3, user names 200, <0>
+    string read = "P4" + padded(m_model, 7) + padded(m_serialNumber, 9);
+    read += "V" + padded(m_firmware, 7);
+    //Each range is 64 words of 32768 / gain, the first one has to be 1
+    for(int range = 0; range < 3; ++range) {
+        for(int j = 0; j < 64; ++j) {
+            appendWord(read, (int)(32768 / sensorGain(j * 2 + 1) + 0.5));
+        }
+    }
+    for(int i = 0; i < 10; ++i) {
+        read += calFile(i + 1).substr(0, 20);
+    }
+    return read + "<0>";
+}
+string KClmtrEmulator::calFileList() const {
+    //D7, then 20 bytes of name for each of the 96
+    string read = "D7";
+    for(int i = 1; i < 97; ++i) {
+        read += m_calFiles[i].substr(0, 20);
+    }
+    return read + "<0>";
+}
+string KClmtrEmulator::calFile(int id) const {
+    if(id < 1 || id > 96) {
+        return string(128, (char)255);
+    }
+    return m_calFiles[id];
+}
+unsigned char KClmtrEmulator::rangeByte() const {
+    //The top three bits are the odd ranges of each channel, the rest are base 3 digits
+    int range = m_range;
+    if(m_autoRange) {
+        //Brighter light needs a higher range
+        range = 1;
+        for(double limit = 1; range < 6 && m_xyz[1] > limit; limit *= 10) {
+            ++range;
+        }
+    }
+    int flag = (range - 1) % 2;
+    int digit = (range - 1) / 2;
+    return (unsigned char)(flag << 7 | flag << 6 | flag << 5 | (digit * 9 + digit * 3 + digit));
+}
+char KClmtrEmulator::errorChar() const {
+    return m_aimingLights ? 'L' : '0';
+}
+string KClmtrEmulator::colorReply(const string &header) const {
+    //N5, X, Y, Z, range, <0>
+    string read = header;
+    for(int i = 0; i < 3; ++i) {
+        unsigned char kFloat[3];
+        packK_float(m_xyz[i], true, kFloat);
+        read.append((const char *)kFloat, 3);
+    }
+    read += (char)rangeByte();
+    read += '<';
+    read += errorChar();
+    read += '>';
+    return read;
+}
+string KClmtrEmulator::countsReply() const {
+    //Counts of both sensors, therm, th1, th2, range, <0>. No header
+    string read;
+    for(int i = 0; i < 6; ++i) {
+        double counts = m_xyz[i % 3] * 100;
+        appendWord(read, counts > 65535 ? 65535 : (int)counts);
+    }
+    appendWord(read, 0x0200);
+    read += (char)100;
+    read += (char)100;
+    read += (char)rangeByte();
+    read += '<';
+    read += errorChar();
+    read += '>';
+    return read;
+}
+string KClmtrEmulator::blackReply(const string &header, const int matrix[19]) const {
+    string read = header;
+    for(int i = 0; i < 19; ++i) {
+        appendWord(read, matrix[i]);
+    }
+    return read + "<0>";
+}
+string KClmtrEmulator::coefficientReply() const {
+    //18 signed words of 4096ths, filled out to 133
+    string read = "S0";
+    for(int i = 0; i < 18; ++i) {
+        appendWord(read, (i % 3 == 1 ? 4096 : 4300) - (i / 3) * 100);
+    }
+    read.append(130 - read.size(), '\0');
+    return read + "<0>";
+}
+string KClmtrEmulator::flickerFrame() {
+    //Every third byte spells out a T2 color reply then _, the two in between are a sample
+    string spelled = colorReply("T2");
+    spelled.append(samplesPerFrame - spelled.size(), '_');
+    double rate = m_fastFlicker ? 384 : 256;
+    double depth = m_flickerPercent / 100 / sensorGain(m_flickerFrequency);
+    string frame;
+    for(int i = 0; i < samplesPerFrame; ++i, ++m_sample) {
+        double ripple = sin(2 * pi * m_flickerFrequency * m_sample / rate);
+        double counts = flickerCounts * (1 + depth * ripple);
+        unsigned int sample = counts < 0 ? 0 : (counts > 65535 ? 65535 : (unsigned int)counts);
+        frame += spelled[i];
+        frame += (char)(sample >> 8);
+        frame += (char)(sample & 0xff);
+    }
+    ++m_frameCount;
+    return frame;
+}
@@ -0,0 +1,209 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#include <string>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include "PtyTransport.h"
+
+namespace KClmtrBase {
+namespace KClmtrNative {
+/**
+ * @brief Acts like a K-10 on the other end of a pseudo terminal, for timing and testing
+ * KClmtr without an instrument
+ * @details open() makes the pty, then KClmtr connects to slaveName() like any other port.
+ * It answers the commands in the KClmtr command table: the measurements are packed as
+ * Klein floats, and the flicker comes as 96 byte frames with a ripple in the samples.
+ * By default every byte takes as long as it does on the wire and each measurement takes
+ * as long as the real one. setFastAsPossible() takes out all of the waiting.
+ * Not in Windows.
+ */
+class KClmtrEmulator {
+public:
+    KClmtrEmulator();
+    ~KClmtrEmulator();
+    /**
+     * @brief Makes the pty
+     * @return false if a pty could not be made
+     */
+    bool open();
+    void close();
+    /**
+     * @brief The port to give KClmtr, like /dev/pts/3
+     */
+    std::string slaveName() const;
+    /**
+     * @brief Answers commands on its own thread until stop()
+     */
+    void start();
+    void stop();
+    /**
+     * @brief Answers commands on this thread until stop() is called from another one
+     */
+    void run();
+    bool isRunning() const;
+
+    //Timing
+    /**
+     * @brief How fast the bytes go back to the host, 0 sends them as fast as the pty takes them
+     * @details A pty does not have a baud rate, so this has to match what KClmtr is set to.
+     * The new flicker (T1) goes at 19200 the same as the device.
+     */
+    void setBaudRate(int speed);
+    int getBaudRate() const;
+    /**
+     * @brief How long the device takes to start answering any command
+     */
+    void setCommandDelay(long delay_us);
+    long getCommandDelay() const;
+    /**
+     * @brief If the measurements and flicker frames take as long as the real device
+     */
+    void setRealTime(bool realTime);
+    bool getRealTime() const;
+    /**
+     * @brief No wire time, command delay or measuring time, the flicker frames go out
+     * as soon as the last one is taken
+     */
+    void setFastAsPossible();
+
+    //What it is
+    void setModel(const std::string &model, const std::string &serialNumber);
+    /**
+     * @brief The firmware version, like "01.10fh". Newer than "01.09fh" has the faster flicker
+     */
+    void setFirmware(const std::string &firmware);
+    /**
+     * @brief Puts a cal file in the device
+     * @param id 1 to 96
+     * @param name Up to 20 characters
+     * @param matrix The 3x3 XYZ matrix, row by row
+     */
+    void setCalFile(int id, const std::string &name, const double matrix[9]);
+
+    //What it is looking at
+    void setXYZ(double bigX, double bigY, double bigZ);
+    /**
+     * @brief The ripple on the light for flicker
+     * @param frequency Hz
+     * @param percent The peak of the ripple, as percent of the average
+     */
+    void setFlicker(double frequency, double percent);
+
+    /**
+     * @brief Commands that have been answered
+     */
+    unsigned long long getCommandCount() const;
+    /**
+     * @brief Flicker frames that have been sent
+     */
+    unsigned long long getFrameCount() const;
+
+    /**
+     * @brief Packs a number the way the device does
+     * @param v The number
+     * @param measurement true for the XYZ in the measurements, which are half of the
+     * ones in the matrices
+     * @param out 3 bytes
+     */
+    static void packK_float(double v, bool measurement, unsigned char out[3]);
+private:
+    KClmtrEmulator(const KClmtrEmulator &);
+    KClmtrEmulator &operator=(const KClmtrEmulator &);
+
+    enum _inputState {
+        COMMAND,			//Commands end with \r
+        CALFILE_INDEX,		//After D1, one byte of index and \r
+        CALFILE_STORE,		//After D9, MAT + id + ( + 128 bytes + ) + \r
+        BLACKCAL_PASSWORD	//After B7, the password ends with \r
+    };
+    struct pendingReply {
+        long long readyAt;	//When the device starts sending it
+        std::string bytes;
+    };
+
+    void handleInput(long long now);
+    void handleCommand(const std::string &commandString, long long now);
+    long long schedule(long long now, long work_us);
+    void queueReply(const std::string &bytes, long long readyAt);
+    void queueFlickerFrame(long long now);
+    long flush(long long now);
+
+    std::string deviceInfo() const;
+    std::string flickerInfo() const;
+    std::string calFileList() const;
+    std::string calFile(int id) const;
+    std::string colorReply(const std::string &header) const;
+    std::string countsReply() const;
+    std::string blackReply(const std::string &header, const int matrix[19]) const;
+    std::string coefficientReply() const;
+    std::string flickerFrame();
+    unsigned char rangeByte() const;
+    char errorChar() const;
+    int wireSpeed() const;
+
+    PtyTransport m_port;
+    std::thread m_thread;
+    std::atomic<bool> m_running;
+    mutable std::mutex m_lock;
+
+    //Timing
+    int m_baudRate;
+    long m_commandDelay;
+    bool m_realTime;
+
+    //The device
+    std::string m_model;
+    std::string m_serialNumber;
+    std::string m_firmware;
+    std::string m_calFiles[97];
+    int m_blackRAM[19];
+    int m_blackFlash[19];
+    int m_range;			//1-6
+    bool m_autoRange;
+    bool m_aimingLights;
+
+    //The light
+    double m_xyz[3];
+    double m_flickerFrequency;
+    double m_flickerPercent;
+
+    //The conversation
+    _inputState m_inputState;
+    std::string m_input;
+    std::deque<pendingReply> m_output;
+    size_t m_outputSent;		//Bytes of the front reply already written
+    long long m_wireFreeAt;		//When the last byte written is done going over the wire
+    long long m_busyUntil;		//When the device is done with the last command
+    bool m_streaming;
+    bool m_fastFlicker;			//T1, 384 samples a second
+    long long m_nextFrameAt;
+    unsigned long long m_sample;
+    unsigned long long m_commandCount;
+    unsigned long long m_frameCount;
+};
+}
+}
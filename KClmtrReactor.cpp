@@ -0,0 +1,252 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "KClmtrReactor.h"
+#include "Timing.h"
+#include <algorithm>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+using namespace std;
+using namespace KClmtrBase::KClmtrNative;
+
+KClmtrReactor::KClmtrReactor() : m_epoll(-1), m_wakeup(-1), m_exited(false), m_stopping(false), m_wakeups(0) {
+#ifdef __linux__
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(m_epoll != -1 && m_wakeup != -1) {
+        //The wake up is the only one without a KClmtr
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+        if(epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &event) == 0) {
+            m_thread = thread(&KClmtrReactor::run, this);
+            return;
+        }
+    }
+    if(m_wakeup != -1) {
+        close(m_wakeup);
+        m_wakeup = -1;
+    }
+    if(m_epoll != -1) {
+        close(m_epoll);
+        m_epoll = -1;
+    }
+#endif
+}
+KClmtrReactor::~KClmtrReactor() {
+    m_stopping = true;
+    wake();
+    if(m_thread.joinable()) {
+        m_thread.join();
+    }
+#ifdef __linux__
+    if(m_wakeup != -1) {
+        close(m_wakeup);
+    }
+    if(m_epoll != -1) {
+        close(m_epoll);
+    }
+#endif
+}
+bool KClmtrReactor::isRunning() const {
+    return m_thread.joinable() && !m_stopping;
+}
+size_t KClmtrReactor::size() {
+    lock_guard<mutex> lock(m_lock);
+    return m_devices.size();
+}
+unsigned long long KClmtrReactor::getWakeups() const {
+    return m_wakeups;
+}
+bool KClmtrReactor::attach(KClmtr &kclmtr) {
+    if(!isRunning() || kclmtr.m_transport->fileDescriptor() == -1) {
+        return false;
+    }
+    if(this_thread::get_id() == m_thread.get_id()) {
+        //Started from one of the callbacks
+        begin(&kclmtr);
+        return true;
+    }
+    unique_lock<mutex> lock(m_lock);
+    if(m_stopping || m_exited) {
+        return false;
+    }
+    m_starting.push_back(&kclmtr);
+    wake();
+    //The stream is started on the thread, so the KClmtr is never used from two at once
+    vector<KClmtr *>::iterator waiting;
+    while((waiting = find(m_starting.begin(), m_starting.end(), &kclmtr)) != m_starting.end() && !m_exited) {
+        m_started.wait(lock);
+    }
+    if(waiting != m_starting.end()) {
+        //The thread stopped before it got to it, begin() never ran
+        m_starting.erase(waiting);
+        return false;
+    }
+    //Only begin() takes it out of m_starting, and it is in m_devices from then until it is finished
+    return true;
+}
+void KClmtrReactor::wake() {
+#ifdef __linux__
+    if(m_wakeup != -1) {
+        uint64_t one = 1;
+        if(write(m_wakeup, &one, sizeof(one)) < 0) {
+            //Already has a wake up waiting
+        }
+    }
+#endif
+}
+void KClmtrReactor::begin(KClmtr *kclmtr) {
+#ifdef __linux__
+    kclmtr->setChildMode(KClmtr::RUN);
+    kclmtr->beginStream();
+
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = kclmtr;
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_devices.push_back(kclmtr);
+    }
+    if(epoll_ctl(m_epoll, EPOLL_CTL_ADD, kclmtr->m_transport->fileDescriptor(), &event) != 0) {
+        kclmtr->handleStreamFrame(KleinsErrorCodes::LOST_CONNECTION, Frame());
+    } else if(kclmtr->parentMode() == KClmtr::RUN) {
+        kclmtr->requestStreamFrame();
+    }
+#endif
+}
+void KClmtrReactor::finish(KClmtr *kclmtr) {
+#ifdef __linux__
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, kclmtr->m_transport->fileDescriptor(), NULL);
+#endif
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_devices.erase(find(m_devices.begin(), m_devices.end(), kclmtr));
+    }
+    kclmtr->endThread();
+}
+bool KClmtrReactor::isAttached(KClmtr *kclmtr) {
+    return find(m_devices.begin(), m_devices.end(), kclmtr) != m_devices.end();
+}
+int KClmtrReactor::nextTimeOut() {
+    if(m_devices.empty()) {
+        return -1;
+    }
+    long long deadline = m_devices[0]->m_streamDeadline;
+    for(size_t i = 1; i < m_devices.size(); ++i) {
+        deadline = min(deadline, m_devices[i]->m_streamDeadline);
+    }
+    long long remaining = deadline - monotonicMicroseconds();
+    return remaining <= 0 ? 0 : (int)((remaining + 999) / 1000);
+}
+void KClmtrReactor::excludeStall(KClmtr *kclmtr, long long since) {
+    //Replies that came in meanwhile are still waiting on their ports, they were not late.
+    //Only the thread changes the deadlines, so this is safe without the lock
+    long long stall = monotonicMicroseconds() - since;
+    for(size_t i = 0; i < m_devices.size(); ++i) {
+        if(m_devices[i] != kclmtr) {
+            m_devices[i]->m_streamDeadline += stall;
+        }
+    }
+}
+void KClmtrReactor::run() {
+#ifdef __linux__
+    const int maxEvents = 16;
+    epoll_event events[maxEvents];
+    while(!m_stopping) {
+        int n = epoll_wait(m_epoll, events, maxEvents, nextTimeOut());
+        ++m_wakeups;
+        if(n < 0 && errno != EINTR) {
+            break;
+        }
+        for(int i = 0; i < n; ++i) {
+            KClmtr *kclmtr = (KClmtr *)events[i].data.ptr;
+            if(kclmtr == NULL) {
+                uint64_t count;
+                if(read(m_wakeup, &count, sizeof(count)) < 0) {
+                    //Someone else already read it
+                }
+            } else if(isAttached(kclmtr) && kclmtr->parentMode() == KClmtr::RUN) {
+                //Queued commands are sent between frames and wait for their replies
+                long long start = monotonicMicroseconds();
+                kclmtr->pollStream();
+                if(kclmtr->parentMode() == KClmtr::RUN && (events[i].events & (EPOLLHUP | EPOLLERR))) {
+                    //The device is gone, it would wake us up forever
+                    kclmtr->handleStreamFrame(KleinsErrorCodes::LOST_CONNECTION, Frame());
+                }
+                excludeStall(kclmtr, start);
+            }
+        }
+        vector<KClmtr *> starting;
+        {
+            lock_guard<mutex> lock(m_lock);
+            starting = m_starting;
+        }
+        for(size_t i = 0; i < starting.size(); ++i) {
+            //Starting flicker talks to the device before the stream is going
+            long long start = monotonicMicroseconds();
+            begin(starting[i]);
+            excludeStall(starting[i], start);
+        }
+        if(!starting.empty()) {
+            lock_guard<mutex> lock(m_lock);
+            for(size_t i = 0; i < starting.size(); ++i) {
+                m_starting.erase(find(m_starting.begin(), m_starting.end(), starting[i]));
+            }
+            m_started.notify_all();
+        }
+        //A callback can start and stop devices, so the list can change under us
+        vector<KClmtr *> devices = m_devices;
+        long long now = monotonicMicroseconds();
+        for(size_t i = 0; i < devices.size(); ++i) {
+            if(isAttached(devices[i])) {
+                devices[i]->checkStreamDeadline(now);
+            }
+        }
+        for(size_t i = 0; i < devices.size(); ++i) {
+            if(isAttached(devices[i]) && devices[i]->parentMode() != KClmtr::RUN) {
+                //Stopping flicker waits for the port to go quiet
+                long long start = monotonicMicroseconds();
+                finish(devices[i]);
+                excludeStall(devices[i], start);
+            }
+        }
+    }
+#endif
+    //Nothing is left waiting on a thread that is gone
+    vector<KClmtr *> devices = m_devices;
+    for(size_t i = 0; i < devices.size(); ++i) {
+        devices[i]->setParentMode(KClmtr::STOP);
+        finish(devices[i]);
+    }
+    //Whoever is still in attach() takes itself out of m_starting
+    lock_guard<mutex> lock(m_lock);
+    m_stopping = true;
+    m_exited = true;
+    m_started.notify_all();
+}
@@ -0,0 +1,96 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "KClmtr.h"
+
+namespace KClmtrBase {
+namespace KClmtrNative {
+/**
+ * @brief One thread that runs the streams of many KClmtr at once
+ * @details Each KClmtr normally gets its own thread while measuring, flickering or getting counts.
+ * With KClmtr::setReactor(), the port is added to this thread's epoll instead, and it sends the
+ * commands, reads whatever is ready and hands out the frames as they finish. Nothing is read until
+ * the port has something. Queued commands, starting and stopping flicker and the callbacks still
+ * block the thread while they run, that time is not counted against the other devices' deadlines.
+ * Only on Linux, everywhere else isRunning() is false and each KClmtr keeps its own thread.
+ */
+class KClmtrReactor {
+public:
+    /**
+     * @brief Starts the thread
+     */
+    KClmtrReactor();
+    /**
+     * @brief Stops every stream still on it, then the thread
+     */
+    ~KClmtrReactor();
+    /**
+     * @brief Can devices be added to it
+     */
+    bool isRunning() const;
+    /**
+     * @brief The number of devices streaming on it
+     */
+    size_t size();
+    /**
+     * @brief The number of times the thread has woken up, to compare against the frames it handed out
+     */
+    unsigned long long getWakeups() const;
+private:
+    KClmtrReactor(const KClmtrReactor &);
+    KClmtrReactor &operator=(const KClmtrReactor &);
+
+    //From KClmtr::startThread2() and stopThread2()
+    friend class KClmtr;
+    bool attach(KClmtr &kclmtr);
+    void wake();
+
+    void run();
+    void begin(KClmtr *kclmtr);
+    void finish(KClmtr *kclmtr);
+    bool isAttached(KClmtr *kclmtr);
+    int nextTimeOut();
+    void excludeStall(KClmtr *kclmtr, long long since);
+
+    int m_epoll;
+    int m_wakeup;
+    std::mutex m_lock;
+    std::condition_variable m_started;
+    //Waiting for the thread to start them
+    std::vector<KClmtr *> m_starting;
+    //run() is done with m_starting, under m_lock. m_stopping alone can be set while it is still starting them
+    bool m_exited;
+    //Streaming, only changed on the thread
+    std::vector<KClmtr *> m_devices;
+    std::atomic<bool> m_stopping;
+    std::atomic<unsigned long long> m_wakeups;
+    std::thread m_thread;
+};
+}
+}
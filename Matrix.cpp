@@ -48,7 +48,13 @@ bool Matrix<T>::operator==(const Matrix<T> &other) const {
 }
 template <typename T>
 Matrix<T>& Matrix<T>::operator=(const Matrix<T> &other) {
-    this->initializeV(other.row, other.column);
+    if(this == &other) {
+        return *this;
+    }
+    //Same size keeps the rows it has, so copying frames over each other doesn't allocate
+    if(row != other.row || column != other.column) {
+        this->initializeV(other.row, other.column);
+    }
 
     for(unsigned int i = 0; i < getRow(); ++i) {
         for(unsigned int j = 0; j < getColumn(); ++j) {
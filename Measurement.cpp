@@ -1465,6 +1465,12 @@ double Measurement::getColorTemputure_duv() const {
 unsigned int Measurement::getErrorCode() const {
     return errorcode;
 }
+long long Measurement::getTimestamp() const {
+    return timestamp;
+}
+unsigned long Measurement::getSequence() const {
+    return sequence;
+}
 int Measurement::getAveragingby() const {
     return averagingby;
 }
@@ -1524,6 +1530,8 @@ Measurement::Measurement(const Measurement &m) {
     maxY = m.maxY;
     minZ = m.minZ;
     maxZ = m.maxZ;
+    timestamp = m.timestamp;
+    sequence = m.sequence;
 
     gs = GamutSpec::fromCode(GamutCode::defaultGamut);
 }
@@ -1562,6 +1570,8 @@ Measurement::Measurement() {
     minX = maxX = 0;
     minY = maxY = 0;
     minZ = maxZ = 0;
+    timestamp = 0;
+    sequence = 0;
 
     gs = GamutSpec::fromCode(GamutCode::defaultGamut);
 }
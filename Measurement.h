@@ -204,6 +204,8 @@ public:
     double getColorTemputure_K() const;
     double getColorTemputure_duv() const;	/**< The Color Temputers distance off the black body curve */
     unsigned int getErrorCode() const;		/**< The number of measurements that was averaged togather */
+    long long getTimestamp() const;			/**< When the last byte of the reply was read, in microseconds from monotonicMicroseconds(). 0 if it did not come from the device */
+    unsigned long getSequence() const;		/**< The number of the reply since the stream or getNextMeasurement() started, from 1. A gap means some were never seen */
     int getAveragingby() const;				/**< The number of measurements that was averaged togather	*/
     double getMinX() const;					/**< The min X in the XYZ, from all the measurements that was averaged togather*/
     double getMaxX() const;					/**< The max X in the XYZ, from all the measurements that was averaged togather*/
@@ -366,6 +368,8 @@ private:
     double maxY;
     double minZ;
     double maxZ;
+    long long timestamp;
+    unsigned long sequence;
 
     //Main function to change XYZ to all others
     void computeDerivativeData(double _bigX, double _bigY, double _bigZ, const GamutSpec &_gs);
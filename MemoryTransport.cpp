@@ -0,0 +1,113 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "MemoryTransport.h"
+#include <cstring>
+
+using namespace std;
+using namespace KClmtrBase::KClmtrNative;
+
+MemoryTransport::MemoryTransport() {
+    m_readAt = 0;
+    m_open = false;
+}
+MemoryTransport::~MemoryTransport() {
+}
+bool MemoryTransport::openPort() {
+    lock_guard<mutex> guard(m_lock);
+    m_open = true;
+    m_written.clear();
+    return true;
+}
+bool MemoryTransport::closePort() {
+    lock_guard<mutex> guard(m_lock);
+    bool wasOpen = m_open;
+    m_open = false;
+    m_incoming.clear();
+    m_readAt = 0;
+    m_rxBuffer.clear();
+    return wasOpen;
+}
+bool MemoryTransport::isOpen() {
+    lock_guard<mutex> guard(m_lock);
+    return m_open;
+}
+bool MemoryTransport::setSetting(int speed, int, char, int) {
+    m_speed = speed;
+    return isOpen();
+}
+int MemoryTransport::writeSome(const unsigned char *buf, size_t bufSize) {
+    {
+        lock_guard<mutex> guard(m_lock);
+        if(!m_open) {
+            return -1;
+        }
+        m_written.append(reinterpret_cast<const char *>(buf), bufSize);
+    }
+    onWrite(buf, bufSize);
+    return (int)bufSize;
+}
+void MemoryTransport::push(const unsigned char *buf, size_t size) {
+    lock_guard<mutex> guard(m_lock);
+    //Dropping what has been read, so it doesn't keep growing
+    if(m_readAt > 0 && m_readAt * 2 >= m_incoming.size()) {
+        m_incoming.erase(0, m_readAt);
+        m_readAt = 0;
+    }
+    m_incoming.append(reinterpret_cast<const char *>(buf), size);
+}
+void MemoryTransport::push(const string &bytes) {
+    push(reinterpret_cast<const unsigned char *>(bytes.data()), bytes.size());
+}
+size_t MemoryTransport::pending() {
+    lock_guard<mutex> guard(m_lock);
+    return m_incoming.size() - m_readAt;
+}
+string MemoryTransport::written() {
+    lock_guard<mutex> guard(m_lock);
+    return m_written;
+}
+void MemoryTransport::onWrite(const unsigned char *, size_t) {
+}
+void MemoryTransport::onIdle() {
+}
+int MemoryTransport::readSome(unsigned char *buf, size_t max) {
+    lock_guard<mutex> guard(m_lock);
+    if(!m_open) {
+        return -1;
+    }
+    size_t n = m_incoming.size() - m_readAt;
+    if(n > max) {
+        n = max;
+    }
+    memcpy(buf, m_incoming.data() + m_readAt, n);
+    m_readAt += n;
+    return (int)n;
+}
+bool MemoryTransport::waitReadable(long) {
+    if(pending() == 0) {
+        onIdle();
+    }
+    //Bytes only come from push(), sleeping would only slow things down
+    return pending() > 0;
+}
@@ -0,0 +1,81 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#include <mutex>
+#include "Transport.h"
+
+namespace KClmtrBase {
+namespace KClmtrNative {
+/**
+ * @brief A port that lives in memory, the bytes the host reads are pushed in with push()
+ * @details Nothing ever waits, so KClmtr runs at full CPU speed. Inherit it and override
+ * onWrite() to answer commands, and onIdle() to keep a stream going.
+ */
+class MemoryTransport : public Transport {
+public:
+    MemoryTransport();
+    virtual ~MemoryTransport();
+    bool openPort();
+    bool closePort();
+    bool isOpen();
+    /**
+     * @brief There is no wire, the speed is only remembered
+     */
+    bool setSetting(int speed, int wordSize, char parity, int timeOut);
+
+    /**
+     * @brief Adds bytes for the host to read
+     */
+    void push(const unsigned char *buf, size_t size);
+    void push(const std::string &bytes);
+    /**
+     * @brief The number of pushed bytes that have not been read yet
+     */
+    size_t pending();
+    /**
+     * @brief Everything the host has written since it was opened
+     */
+    std::string written();
+protected:
+    /**
+     * @brief Called for every write from the host, after it is added to written()
+     */
+    virtual void onWrite(const unsigned char *buf, size_t size);
+    /**
+     * @brief Called when the host waits and nothing is pending, it can push() more
+     */
+    virtual void onIdle();
+
+    int readSome(unsigned char *buf, size_t max);
+    bool waitReadable(long timeOut_ms);
+    int writeSome(const unsigned char *buf, size_t bufSize);
+private:
+    std::mutex m_lock;
+    std::string m_incoming;
+    size_t m_readAt;
+    std::string m_written;
+    bool m_open;
+};
+}
+}
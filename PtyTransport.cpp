@@ -0,0 +1,136 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "PtyTransport.h"
+
+#ifndef WIN32
+#include <termios.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <cerrno>
+#include <cstdlib>
+#endif
+
+using namespace std;
+using namespace KClmtrBase::KClmtrNative;
+
+PtyTransport::PtyTransport() {
+    m_fileHandle = -1;
+}
+PtyTransport::~PtyTransport() {
+    closePort();
+}
+bool PtyTransport::openPort() {
+#ifdef WIN32
+    return false;
+#else
+    closePort();
+    m_fileHandle = posix_openpt(O_RDWR | O_NOCTTY);
+    if(m_fileHandle == -1) {
+        return false;
+    }
+    if(grantpt(m_fileHandle) != 0 || unlockpt(m_fileHandle) != 0) {
+        closePort();
+        return false;
+    }
+    const char *name = ptsname(m_fileHandle);
+    if(name == NULL) {
+        closePort();
+        return false;
+    }
+    m_slaveName = name;
+    portName = m_slaveName;
+
+    //No echo or line editing, the bytes go through as they are
+    struct termios options;
+    if(tcgetattr(m_fileHandle, &options) == 0) {
+        cfmakeraw(&options);
+        tcsetattr(m_fileHandle, TCSANOW, &options);
+    }
+    fcntl(m_fileHandle, F_SETFL, fcntl(m_fileHandle, F_GETFL) | O_NONBLOCK);
+    return true;
+#endif
+}
+bool PtyTransport::closePort() {
+    m_rxBuffer.clear();
+    m_slaveName = "";
+    if(m_fileHandle == -1) {
+        return false;
+    }
+#ifdef WIN32
+    return false;
+#else
+    bool returnValue = close(m_fileHandle) == 0;
+    m_fileHandle = -1;
+    return returnValue;
+#endif
+}
+bool PtyTransport::isOpen() {
+    return m_fileHandle != -1;
+}
+int PtyTransport::fileDescriptor() const {
+    return m_fileHandle;
+}
+bool PtyTransport::setSetting(int speed, int, char, int) {
+    m_speed = speed;
+    return isOpen();
+}
+int PtyTransport::writeSome(const unsigned char *buf, size_t bufSize) {
+#ifdef WIN32
+    return -1;
+#else
+    return write(m_fileHandle, buf, bufSize);
+#endif
+}
+string PtyTransport::slaveName() const {
+    return m_slaveName;
+}
+int PtyTransport::readSome(unsigned char *buf, size_t max) {
+#ifdef WIN32
+    return -1;
+#else
+    int n = read(m_fileHandle, buf, max);
+    if(n < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return 0;
+    }
+    //EIO is the other end not being open (yet)
+    if(n < 0 && errno == EIO) {
+        return 0;
+    }
+    return n;
+#endif
+}
+bool PtyTransport::waitReadable(long timeOut_ms) {
+#ifdef WIN32
+    return false;
+#else
+    short revents = pollPort(m_fileHandle, timeOut_ms);
+    if(revents & POLLHUP) {
+        //Nobody on the other end yet, checking again in a bit like a quiet wire
+        usleep((timeOut_ms < 10 ? timeOut_ms : 10) * 1000);
+        return true;
+    }
+    return revents != 0 && !(revents & (POLLERR | POLLNVAL));
+#endif
+}
@@ -0,0 +1,60 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#include "Transport.h"
+
+namespace KClmtrBase {
+namespace KClmtrNative {
+/**
+ * @brief The host end of a pseudo terminal, for talking to something that acts like a
+ * device on the other end, like the emulator
+ * @details openPort() makes a new pty, whatever opens slaveName() is on the other side.
+ * Not in Windows.
+ */
+class PtyTransport : public Transport {
+public:
+    PtyTransport();
+    virtual ~PtyTransport();
+    bool openPort();
+    bool closePort();
+    bool isOpen();
+    /**
+     * @brief A pty has no baud rate, the speed is only remembered
+     */
+    bool setSetting(int speed, int wordSize, char parity, int timeOut);
+    /**
+     * @brief The device end of the pty, like /dev/pts/3, empty until openPort()
+     */
+    std::string slaveName() const;
+    int fileDescriptor() const;
+protected:
+    int readSome(unsigned char *buf, size_t max);
+    bool waitReadable(long timeOut_ms);
+    int writeSome(const unsigned char *buf, size_t bufSize);
+private:
+    int m_fileHandle;
+    std::string m_slaveName;
+};
+}
+}
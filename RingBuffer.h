@@ -0,0 +1,205 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace KClmtrBase {
+namespace KClmtrNative {
+/**
+ * @brief A non-owning look at bytes that live somewhere else, like in a RingBuffer
+ * It is only good until the owner of the bytes changes them
+ */
+struct ByteView {
+    const unsigned char *data;	/**< The first byte */
+    size_t size;				/**< How many bytes can be looked at */
+
+    ByteView() {
+        data = NULL;
+        size = 0;
+    }
+    ByteView(const unsigned char *_data, size_t _size) {
+        data = _data;
+        size = _size;
+    }
+    unsigned char operator[](size_t i) const {
+        return data[i];
+    }
+    /**
+     * @brief A smaller view into the same bytes
+     */
+    ByteView sub(size_t offset, size_t length) const {
+        if(offset > size) {
+            offset = size;
+        }
+        if(length > size - offset) {
+            length = size - offset;
+        }
+        return ByteView(data + offset, length);
+    }
+};
+
+/**
+ * @brief Fixed size byte ring. The storage is made once, then the read path fills it in place
+ */
+class RingBuffer {
+public:
+    static const size_t npos = (size_t) -1;
+
+    /**
+     * @param capacity Max number of bytes it can hold
+     */
+    RingBuffer(size_t capacity) {
+        m_capacity = capacity;
+        m_buffer = new unsigned char[m_capacity];
+        m_head = 0;
+        m_size = 0;
+    }
+    ~RingBuffer() {
+        delete[] m_buffer;
+    }
+
+    size_t size() const {
+        return m_size;
+    }
+    size_t capacity() const {
+        return m_capacity;
+    }
+    size_t available() const {
+        return m_capacity - m_size;
+    }
+    bool empty() const {
+        return m_size == 0;
+    }
+    unsigned char operator[](size_t i) const {
+        return m_buffer[(m_head + i) % m_capacity];
+    }
+    void clear() {
+        m_head = 0;
+        m_size = 0;
+    }
+
+    /**
+     * @brief The free space that can be written in one go
+     * @param length how many bytes can be written at the returned pointer
+     * @return where to write, follow it with commit()
+     */
+    unsigned char *writeSpace(size_t &length) {
+        size_t tail = (m_head + m_size) % m_capacity;
+        if(m_size == m_capacity) {
+            length = 0;
+        } else if(tail >= m_head) {
+            length = m_capacity - tail;
+        } else {
+            length = m_head - tail;
+        }
+        return m_buffer + tail;
+    }
+    /**
+     * @brief Adds the bytes that got written into writeSpace()
+     */
+    void commit(size_t n) {
+        m_size += std::min(n, available());
+    }
+    /**
+     * @brief Copies in bytes at the end, anything that does not fit is dropped
+     * @return the number of bytes copied
+     */
+    size_t write(const unsigned char *bytes, size_t n) {
+        size_t written = 0;
+        while(written < n) {
+            size_t length;
+            unsigned char *w = writeSpace(length);
+            if(length == 0) {
+                break;
+            }
+            length = std::min(length, n - written);
+            memcpy(w, bytes + written, length);
+            commit(length);
+            written += length;
+        }
+        return written;
+    }
+    /**
+     * @brief Removes bytes off the front
+     */
+    void consume(size_t n) {
+        if(n >= m_size) {
+            //Going back to the front keeps most frames from wrapping
+            clear();
+        } else {
+            m_head = (m_head + n) % m_capacity;
+            m_size -= n;
+        }
+    }
+    /**
+     * @brief Copies bytes off the front, without removing them
+     * @return the number of bytes copied
+     */
+    size_t copyOut(unsigned char *dst, size_t n) const {
+        n = std::min(n, m_size);
+        size_t first = std::min(n, m_capacity - m_head);
+        memcpy(dst, m_buffer + m_head, first);
+        memcpy(dst + first, m_buffer, n - first);
+        return n;
+    }
+    /**
+     * @brief Finds a byte
+     * @param c the byte
+     * @param from the index to start looking at
+     * @return the index, or npos
+     */
+    size_t find(unsigned char c, size_t from = 0) const {
+        for(size_t i = from; i < m_size; ++i) {
+            if((*this)[i] == c) {
+                return i;
+            }
+        }
+        return npos;
+    }
+    /**
+     * @brief Makes the first n bytes sit next to each other and looks at them
+     * If they wrap around the end, the storage is rotated in place
+     * @return the view, good until the ring is changed
+     */
+    ByteView view(size_t n) {
+        n = std::min(n, m_size);
+        if(m_head + n > m_capacity) {
+            std::rotate(m_buffer, m_buffer + m_head, m_buffer + m_capacity);
+            m_head = 0;
+        }
+        return ByteView(m_buffer + m_head, n);
+    }
+private:
+    RingBuffer(const RingBuffer &);
+    RingBuffer &operator=(const RingBuffer &);
+
+    unsigned char *m_buffer;
+    size_t m_capacity;
+    size_t m_head;
+    size_t m_size;
+};
+}
+}
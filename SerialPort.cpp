@@ -22,6 +22,7 @@ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 OTHER DEALINGS IN THE SOFTWARE.
 */
 #include "SerialPort.h"
+#include "Timing.h"
 
 #ifdef WIN32
 #else
@@ -32,18 +33,48 @@ OTHER DEALINGS IN THE SOFTWARE.
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/file.h>
+#include <poll.h>
+#include <cerrno>
 #include <cstdio>
 #include <cstring>
+#ifdef __linux__
+#include <asm/ioctls.h>
+#include <linux/serial.h>
+#include <climits>
+#include <cstdlib>
+//From asm/termbits.h, which can not be included next to termios.h
+struct termios2 {
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[19];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+#elif defined(__APPLE__)
+#include <IOKit/serial/ioss.h>
+#endif
 #endif
 
 using namespace std;
 using namespace KClmtrBase::KClmtrNative;
 
 SerialPort::SerialPort(void) {
+    m_lowLatency = false;
 #ifdef WIN32
     m_fileHandle = NULL;
+    m_overruns = 0;
 #else
     m_fileHandle = -1;
+    m_latencySaved = false;
+    m_savedLatencyTimer = -1;
+    m_savedSerialFlags = -1;
+    m_overrunBase = 0;
 #endif
 }
 SerialPort::~SerialPort(void) {
@@ -70,6 +101,7 @@ bool SerialPort::openPort() {
     if(m_fileHandle == INVALID_HANDLE_VALUE) {
         return false;
     } else {
+        m_overruns = 0;
         return true;
     }
 #else
@@ -79,6 +111,7 @@ bool SerialPort::openPort() {
     } else {
         //Locking File
         if(lockFile()) {
+            m_overrunBase = kernelOverruns();
             return true;
         } else {
             closePort();
@@ -91,6 +124,7 @@ bool SerialPort::openPort() {
 }
 bool SerialPort::closePort() {
 #ifdef WIN32
+    m_rxBuffer.clear();
     if(m_fileHandle != NULL && CloseHandle(m_fileHandle)) {
         //Make sure after CloseHandle the handle gets reset
         m_fileHandle = NULL;
@@ -99,9 +133,11 @@ bool SerialPort::closePort() {
 
     return false;
 #else
+    restoreLatency();
     bool returnValue = close(m_fileHandle) == 0;
     unLockFile();
     m_fileHandle = -1;
+    m_rxBuffer.clear();
     return returnValue;
 #endif
 }
@@ -129,6 +165,7 @@ bool SerialPort::setSetting(int speed, int wordSize, char parity, int timeOut) {
     if(!SetCommState(m_fileHandle, &dcb)) {
         return false;
     }
+    m_speed = speed;
 
     if(!SetupComm(m_fileHandle, 1600, 1600)) {
         return false;
@@ -147,8 +184,11 @@ bool SerialPort::setSetting(int speed, int wordSize, char parity, int timeOut) {
 
     return true;
 #else
+    //The reads wait with poll() and their own time out, see receive()
+    (void)timeOut;
     struct termios options;
     speed_t speedT;
+    bool custom = false;
     tcgetattr(m_fileHandle, &options);
     //cfmakeraw(&options);
     //options.c_lflag = 0;
@@ -196,8 +236,28 @@ bool SerialPort::setSetting(int speed, int wordSize, char parity, int timeOut) {
         case 38400:
             speedT = B38400;
             break;
+#ifdef B57600
+        case 57600:
+            speedT = B57600;
+            break;
+#endif
+#ifdef B115200
+        case 115200:
+            speedT = B115200;
+            break;
+#endif
+#ifdef B230400
+        case 230400:
+            speedT = B230400;
+            break;
+#endif
         default:
-            speedT = B19200;
+            //Set after the rest of the settings, with setCustomSpeed()
+            if(speed <= 0) {
+                return false;
+            }
+            speedT = B38400;
+            custom = true;
             break;
     }
 
@@ -232,21 +292,68 @@ bool SerialPort::setSetting(int speed, int wordSize, char parity, int timeOut) {
     }
 
 
+    //Reads never block, receive() waits in poll() so it can keep to its time out and cancel()
     options.c_cc[VMIN] = 0;
-    options.c_cc[VTIME] = timeOut * 10;
+    options.c_cc[VTIME] = 0;
+    fcntl(m_fileHandle, F_SETFL, fcntl(m_fileHandle, F_GETFL) | O_NONBLOCK);
     //options.c_cflag = (CLOCAL | CREAD);
     options.c_cflag &= ~CSTOPB; //1 stopbit
     //No Flowcontrol
     options.c_cflag &= ~CRTSCTS;
     options.c_iflag &= ~(IXON | IXOFF | IXANY);
+    if(m_lowLatency) {
+        //Every byte goes straight through, nothing is changed or held for a line
+        options.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL);
+        options.c_oflag &= ~OPOST;
+        options.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+        options.c_cflag |= CLOCAL | CREAD;
+    }
 
 
     if(tcsetattr(m_fileHandle, TCSANOW, &options) != 0) {
         return false;
     }
+    if(custom && !setCustomSpeed(speed)) {
+        return false;
+    }
+    if(m_lowLatency) {
+        applyLowLatency();
+    } else {
+        restoreLatency();
+    }
+    m_speed = speed;
     return true;
 #endif
 }
+#ifndef WIN32
+bool SerialPort::setCustomSpeed(int speed) {
+#ifdef __linux__
+    //BOTHER takes the rate as a number, the driver picks the closest divisor
+    struct termios2 options2;
+    if(ioctl(m_fileHandle, TCGETS2, &options2) != 0) {
+        return false;
+    }
+    options2.c_cflag &= ~CBAUD;
+    options2.c_cflag |= BOTHER;
+    options2.c_ispeed = speed;
+    options2.c_ospeed = speed;
+    if(ioctl(m_fileHandle, TCSETS2, &options2) != 0) {
+        return false;
+    }
+    //Making sure the driver could get close enough, 3% is about what a UART can take
+    if(ioctl(m_fileHandle, TCGETS2, &options2) != 0) {
+        return false;
+    }
+    long actual = (long)options2.c_ospeed;
+    return actual * 100 >= (long)speed * 97 && actual * 100 <= (long)speed * 103;
+#elif defined(__APPLE__)
+    speed_t speedT = speed;
+    return ioctl(m_fileHandle, IOSSIOSPEED, &speedT) == 0;
+#else
+    return false;
+#endif
+}
+#endif
 int SerialPort::readPort(unsigned char *buf, int bufSize) {
 #ifdef WIN32
     if(!isOpen() || m_fileHandle == NULL) {
@@ -269,7 +376,7 @@ int SerialPort::readPort(unsigned char *buf, int bufSize) {
     return read(m_fileHandle, buf, bufSize);
 #endif
 }
-int SerialPort::writePort(const unsigned char *buf, size_t bufSize) {
+int SerialPort::writeSome(const unsigned char *buf, size_t bufSize) {
 #ifdef WIN32
     DWORD write = -1;
     WriteFile(m_fileHandle, buf, (DWORD)bufSize, &write, NULL);
@@ -279,35 +386,189 @@ int SerialPort::writePort(const unsigned char *buf, size_t bufSize) {
     return w;
 #endif
 }
-const string SerialPort::readExisting() {
-    int count = 1;
+void SerialPort::drainOutput() {
+#ifdef WIN32
+    FlushFileBuffers(m_fileHandle);
+#else
+    tcdrain(m_fileHandle);
+#endif
+}
+long SerialPort::getOverruns() {
 #ifdef WIN32
     COMSTAT status;
     DWORD errors;
     if(ClearCommError(m_fileHandle, &errors, &status)) {
-        count = status.cbInQue;
-    } else {
-        count = 0;
+        countErrors(errors);
     }
-
+    return m_overruns;
 #else
-    ioctl(m_fileHandle, FIONREAD, &count);
+    long overruns = kernelOverruns();
+    if(overruns < 0) {
+        return -1;
+    }
+    return overruns - m_overrunBase;
 #endif
-
-    unsigned char *bytes = new unsigned char[count + 1];
-    for(int i = 0; i < count; ++i) {
-        bytes[i] = '\0';
+}
+#ifdef WIN32
+void SerialPort::countErrors(DWORD errors) {
+    //The UART's FIFO or the driver's buffer filled up
+    if(errors & (CE_OVERRUN | CE_RXOVER)) {
+        ++m_overruns;
     }
-
-    //bytes = { '\0' };
-
-    readPort(bytes, count);
-
-    string read = string((char *)bytes, count);
-    delete[] bytes;
-    return read;
+}
+#else
+long SerialPort::kernelOverruns() const {
+#if defined(__linux__) && defined(TIOCGICOUNT)
+    struct serial_icounter_struct counts;
+    if(m_fileHandle != -1 && ioctl(m_fileHandle, TIOCGICOUNT, &counts) == 0) {
+        //The UART's FIFO and the tty's buffer
+        return (long)counts.overrun + (long)counts.buf_overrun;
+    }
+#endif
+    return -1;
+}
+#endif
+int SerialPort::readSome(unsigned char *buf, size_t max) {
+#ifdef WIN32
+    COMSTAT status;
+    DWORD errors;
+    if(!ClearCommError(m_fileHandle, &errors, &status)) {
+        return -1;
+    }
+    countErrors(errors);
+    if(status.cbInQue < max) {
+        max = status.cbInQue;
+    }
+    DWORD numRead = 0;
+    if(max == 0) {
+        return 0;
+    }
+    if(!ReadFile(m_fileHandle, buf, (DWORD)max, &numRead, NULL)) {
+        return -1;
+    }
+    return (int)numRead;
+#else
+    return read(m_fileHandle, buf, max);
+#endif
+}
+bool SerialPort::waitReadable(long timeOut_ms) {
+#ifdef WIN32
+    long long deadline = monotonicMicroseconds() + (long long)timeOut_ms * 1000;
+    do {
+        COMSTAT status;
+        DWORD errors;
+        if(!ClearCommError(m_fileHandle, &errors, &status)) {
+            return false;
+        }
+        countErrors(errors);
+        if(status.cbInQue > 0) {
+            return true;
+        }
+        Sleep(1);
+    } while(!isCancelled() && monotonicMicroseconds() < deadline);
+    return false;
+#else
+    short revents = pollPort(m_fileHandle, timeOut_ms);
+    return revents != 0 && !(revents & (POLLERR | POLLHUP | POLLNVAL));
+#endif
 }
 #ifndef WIN32
+int SerialPort::receive(int expected, long timeOut_ms) {
+    long long start = monotonicMicroseconds();
+    long long deadline = start + (long long)timeOut_ms * 1000;
+    if(expected > (int)m_rxBuffer.capacity()) {
+        expected = (int)m_rxBuffer.capacity();
+    }
+    fill();
+    while((int)m_rxBuffer.size() < expected) {
+        long long remaining = deadline - monotonicMicroseconds();
+        if(remaining <= 0) {
+            break;
+        }
+        //Sleeps in the kernel until more bytes show up, or cancel()
+        short revents = pollPort(m_fileHandle, (long)((remaining + 999) / 1000));
+        if(revents == 0 || (revents & (POLLERR | POLLHUP | POLLNVAL))) {
+            break;
+        }
+        int n = readIntoBuffer(m_rxBuffer.available());
+        if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            break;
+        }
+    }
+    m_lastReadLatency = (long)(monotonicMicroseconds() - start);
+    return (int)m_rxBuffer.size();
+}
+string SerialPort::latencyTimerPath() const {
+#ifdef __linux__
+    //The by-id links and such go back to the ttyUSB
+    char real[PATH_MAX];
+    if(realpath(portName.c_str(), real) == NULL) {
+        return "";
+    }
+    const char *name = strrchr(real, '/');
+    name = name == NULL ? real : name + 1;
+    return string("/sys/class/tty/") + name + "/device/latency_timer";
+#else
+    return "";
+#endif
+}
+void SerialPort::applyLowLatency() {
+#ifdef __linux__
+    if(m_fileHandle == -1) {
+        return;
+    }
+    bool save = !m_latencySaved;
+    m_latencySaved = true;
+    struct serial_struct serial;
+    if(ioctl(m_fileHandle, TIOCGSERIAL, &serial) == 0) {
+        if(save) {
+            m_savedSerialFlags = serial.flags;
+        }
+        if(!(serial.flags & ASYNC_LOW_LATENCY)) {
+            serial.flags |= ASYNC_LOW_LATENCY;
+            ioctl(m_fileHandle, TIOCSSERIAL, &serial);
+        }
+    }
+    //Only FTDI has one, and it is only writable with the right permissions
+    int timer = getLatencyTimer();
+    if(timer > 1) {
+        FILE *file = fopen(latencyTimerPath().c_str(), "w");
+        if(file != NULL) {
+            if(fputs("1", file) >= 0 && save) {
+                m_savedLatencyTimer = timer;
+            }
+            fclose(file);
+        }
+    }
+#endif
+}
+void SerialPort::restoreLatency() {
+#ifdef __linux__
+    if(!m_latencySaved) {
+        return;
+    }
+    m_latencySaved = false;
+    if(m_savedSerialFlags != -1 && m_fileHandle != -1) {
+        struct serial_struct serial;
+        if(ioctl(m_fileHandle, TIOCGSERIAL, &serial) == 0) {
+            serial.flags = m_savedSerialFlags;
+            ioctl(m_fileHandle, TIOCSSERIAL, &serial);
+        }
+    }
+    if(m_savedLatencyTimer != -1) {
+        FILE *file = fopen(latencyTimerPath().c_str(), "w");
+        if(file != NULL) {
+            fprintf(file, "%d", m_savedLatencyTimer);
+            fclose(file);
+        }
+    }
+    m_savedSerialFlags = -1;
+    m_savedLatencyTimer = -1;
+#endif
+}
+int SerialPort::fileDescriptor() const {
+    return m_fileHandle;
+}
 void SerialPort::unLockFile() {
     if(lockedFile != "") {
         close(fd);
@@ -344,6 +605,27 @@ bool SerialPort::lockFile() {
     return false;
 }
 #endif
+void SerialPort::setLowLatency(bool lowLatency) {
+    m_lowLatency = lowLatency;
+}
+bool SerialPort::getLowLatency() const {
+    return m_lowLatency;
+}
+int SerialPort::getLatencyTimer() const {
+#ifdef __linux__
+    int timer = -1;
+    FILE *file = fopen(latencyTimerPath().c_str(), "r");
+    if(file != NULL) {
+        if(fscanf(file, "%d", &timer) != 1) {
+            timer = -1;
+        }
+        fclose(file);
+    }
+    return timer;
+#else
+    return -1;
+#endif
+}
 
 void SerialPort::setDataTerminalReady(bool value) {
 #ifdef WIN32
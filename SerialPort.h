@@ -28,6 +28,7 @@ OTHER DEALINGS IN THE SOFTWARE.
 #endif
 
 #include <string>
+#include "Transport.h"
 
 namespace KClmtrBase {
 namespace KClmtrNative {
@@ -35,7 +36,7 @@ namespace KClmtrNative {
  * @brief Object to control the serial port in Linux, Mac, and Windows
  *
  */
-class SerialPort {
+class SerialPort : public Transport {
 public:
     /**
      * @brief constructor
@@ -52,10 +53,12 @@ public:
     bool closePort();
     /**
      * @brief Settings need to be set after opening the portName
-     * @param speed 	The baud rate of the device
+     * @param speed 	The baud rate of the device, any rate the driver can make
      * @param wordSize 	The size of a char
      * @param parity
-     * @param timeOut	The amount of time it needs to wait in windows before stoping
+     * @param timeOut	The amount of time it needs to wait in windows before stoping.
+     *					Ignored on Linux and Mac, each read has its own time out
+     * @return false if the port did not take the settings, like a rate it can't make
      */
     bool setSetting(int speed, int wordSize, char parity, int timeOut);
     /**
@@ -65,23 +68,17 @@ public:
      * @return the size of string that was returned in buf
      */
     int readPort(unsigned char *buf, int bufSize);
+#ifndef WIN32
     /**
-     * @brief Write to the port
-     * @param buf The string to write
-     * @param bufSize the max size of buf
-     * @return The size of string that was written
-     */
-    int writePort(const unsigned char *buf, size_t bufSize);
-    /**
-     * @brief To find all the bites in the buffer and return it in a string
-     * @return String in the buffer
-     */
-    const std::string readExisting();
-
-    /**
-     * @brief To read and set the port location
+     * @brief Blocks until receiveBuffer() holds expected bytes, the time out has passed or cancel(),
+     * sleeping in poll() between bytes while the port stays non blocking
+     * @param expected The number of bytes to wait for
+     * @param timeOut_ms The max amount of time to wait in milliseconds
+     * @return The number of bytes in receiveBuffer()
      */
-    std::string portName;
+    int receive(int expected, long timeOut_ms);
+    int fileDescriptor() const;
+#endif
     /**
      * @brief To see if the port is open or not
      * return Is the port Open? true = yes
@@ -90,16 +87,53 @@ public:
 
     void setDataTerminalReady(bool value);
     void setRequestToSend(bool value);
+    /**
+     * @brief Has the USB serial driver hand over bytes as soon as they come in, instead of holding them
+     * @details Most Klein devices come through an FTDI chip, which holds what it has for up to its 16 ms latency timer.
+     * On Linux this sets ASYNC_LOW_LATENCY, sets the FTDI latency_timer in sysfs to 1 ms when it can be written,
+     * and makes the port fully raw. What was there before is put back when the port is closed.
+     * It is used from the next setSetting(), nothing changes on other systems.
+     * @param lowLatency on or off, off is the default
+     */
+    void setLowLatency(bool lowLatency);
+    bool getLowLatency() const;
+    /**
+     * @brief The FTDI latency timer of the open port
+     * @return milliseconds, -1 if the port does not have one or it could not be read
+     */
+    int getLatencyTimer() const;
+    void drainOutput();
+    long getOverruns();
 
+protected:
+    int readSome(unsigned char *buf, size_t max);
+    bool waitReadable(long timeOut_ms);
+    int writeSome(const unsigned char *buf, size_t bufSize);
 private:
+    bool m_lowLatency;
 #ifdef WIN32
     HANDLE m_fileHandle;
+    //Counted from ClearCommError(), it does not keep a total
+    long m_overruns;
+    void countErrors(DWORD errors);
 #else
     int fd; //lock file
     int m_fileHandle;
     std::string lockedFile;
     bool lockFile();
     void unLockFile();
+    //For rates without a B constant
+    bool setCustomSpeed(int speed);
+    //What setLowLatency() changed, to put back on closePort()
+    bool m_latencySaved;
+    int m_savedLatencyTimer;
+    int m_savedSerialFlags;
+    std::string latencyTimerPath() const;
+    void applyLowLatency();
+    void restoreLatency();
+    //The driver's totals go back to when it was loaded, this is where they were at openPort()
+    long m_overrunBase;
+    long kernelOverruns() const;
 #endif
 };
 }
@@ -0,0 +1,140 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#include <cstddef>
+
+namespace KClmtrBase {
+namespace KClmtrNative {
+/**
+ * @brief Fixed size queue between one thread that pushes and one that pops, without locks
+ * @details The slots are made once by setCapacity(), after that a push or a pop only copies into or out of a slot.
+ * Whatever T owns is copied too: a Flicker's matrices are only reused when the slot last held one of the
+ * same size, so the first pass through the slots and a change of FFT samples still allocate.
+ * When it is full a push is dropped and counted, so the pushing side never waits.
+ */
+template<typename T>
+class SpscQueue {
+public:
+    SpscQueue() {
+        m_slots = NULL;
+        m_length = 0;
+        m_head = 0;
+        m_tail = 0;
+        m_overflows = 0;
+    }
+    ~SpscQueue() {
+        delete[] m_slots;
+    }
+    /**
+     * @brief Makes room for capacity items and empties it, 0 turns it off.
+     * Nothing can be pushing or popping while it changes
+     */
+    void setCapacity(size_t capacity) {
+        delete[] m_slots;
+        //One slot stays empty, to tell full from empty
+        m_length = capacity == 0 ? 0 : capacity + 1;
+        m_slots = m_length == 0 ? NULL : new T[m_length];
+        m_head = 0;
+        m_tail = 0;
+        m_overflows = 0;
+    }
+    size_t capacity() const {
+        return m_length == 0 ? 0 : m_length - 1;
+    }
+    /**
+     * @brief From the pushing thread
+     * @return false if it was full or turned off, then the item is dropped
+     */
+    bool push(const T &item) {
+        if(m_length == 0) {
+            return false;
+        }
+        size_t tail = m_tail;
+        size_t next = tail + 1 == m_length ? 0 : tail + 1;
+        if(next == loadAcquire(m_head)) {
+            storeRelease(m_overflows, m_overflows + 1);
+            return false;
+        }
+        m_slots[tail] = item;
+        storeRelease(m_tail, next);
+        return true;
+    }
+    /**
+     * @brief From the popping thread
+     * @return false if there was nothing
+     */
+    bool pop(T &item) {
+        size_t head = m_head;
+        if(head == loadAcquire(m_tail)) {
+            return false;
+        }
+        item = m_slots[head];
+        storeRelease(m_head, head + 1 == m_length ? 0 : head + 1);
+        return true;
+    }
+    /**
+     * @brief How many are waiting, it can be behind the pushing thread
+     */
+    size_t size() const {
+        size_t head = loadAcquire(m_head);
+        size_t tail = loadAcquire(m_tail);
+        return tail >= head ? tail - head : tail + m_length - head;
+    }
+    /**
+     * @brief Pushes that were dropped because it was full
+     */
+    size_t overflows() const {
+        return loadAcquire(m_overflows);
+    }
+private:
+#ifdef __GNUC__
+    static size_t loadAcquire(const volatile size_t &value) {
+        return __atomic_load_n(&value, __ATOMIC_ACQUIRE);
+    }
+    static void storeRelease(volatile size_t &value, size_t to) {
+        __atomic_store_n(&value, to, __ATOMIC_RELEASE);
+    }
+#else
+    //volatile already reads with acquire and writes with release on MSVC
+    static size_t loadAcquire(const volatile size_t &value) {
+        return value;
+    }
+    static void storeRelease(volatile size_t &value, size_t to) {
+        value = to;
+    }
+#endif
+    SpscQueue(const SpscQueue &);
+    SpscQueue &operator=(const SpscQueue &);
+
+    T *m_slots;
+    size_t m_length;
+    //Each side writes its own index, they are kept on separate cache lines
+    volatile size_t m_head;		//next to pop, written by the popping thread
+    char m_headPad[64];
+    volatile size_t m_tail;		//next to push into, written by the pushing thread
+    char m_tailPad[64];
+    volatile size_t m_overflows;
+};
+}
+}
@@ -0,0 +1,244 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "Transport.h"
+#include "Timing.h"
+#include "CaptureLog.h"
+#ifndef WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <cerrno>
+#endif
+
+using namespace std;
+using namespace KClmtrBase::KClmtrNative;
+
+//Big enough for the cal file list, or a 2048 sample flicker
+static const size_t receiveBufferSize = 16384;
+
+Transport::Transport() : m_rxBuffer(receiveBufferSize) {
+    m_lastReadLatency = 0;
+    m_lastReadTime = 0;
+    m_capture = NULL;
+    m_speed = 0;
+    m_cancelled = false;
+#ifndef WIN32
+    if(pipe(m_cancelPipe) == 0) {
+        for(int i = 0; i < 2; ++i) {
+            fcntl(m_cancelPipe[i], F_SETFL, fcntl(m_cancelPipe[i], F_GETFL) | O_NONBLOCK);
+            fcntl(m_cancelPipe[i], F_SETFD, FD_CLOEXEC);
+        }
+    } else {
+        //poll() skips -1, only the flag is left
+        m_cancelPipe[0] = m_cancelPipe[1] = -1;
+    }
+#endif
+}
+Transport::~Transport() {
+#ifndef WIN32
+    if(m_cancelPipe[0] != -1) {
+        close(m_cancelPipe[0]);
+        close(m_cancelPipe[1]);
+    }
+#endif
+}
+int Transport::getSpeed() const {
+    return m_speed;
+}
+const string Transport::readExisting() {
+    fill();
+    string read(m_rxBuffer.size(), '\0');
+    if(!read.empty()) {
+        m_rxBuffer.copyOut(reinterpret_cast<unsigned char *>(&read[0]), read.size());
+    }
+    m_rxBuffer.clear();
+    return read;
+}
+void Transport::discardExisting() {
+    fill();
+    m_rxBuffer.clear();
+}
+RingBuffer &Transport::receiveBuffer() {
+    return m_rxBuffer;
+}
+int Transport::readIntoBuffer(size_t max) {
+    size_t length;
+    unsigned char *w = m_rxBuffer.writeSpace(length);
+    if(length > max) {
+        length = max;
+    }
+    if(length == 0) {
+        return 0;
+    }
+    int n = readSome(w, length);
+    if(n > 0) {
+        m_lastReadTime = monotonicMicroseconds();
+        if(m_capture != NULL) {
+            m_capture->record(CaptureRecord::RECEIVED, w, n);
+        }
+        m_rxBuffer.commit(n);
+    }
+    return n;
+}
+int Transport::writePort(const unsigned char *buf, size_t bufSize) {
+    int n = writeSome(buf, bufSize);
+    if(n > 0 && m_capture != NULL) {
+        m_capture->record(CaptureRecord::SENT, buf, n);
+    }
+    return n;
+}
+int Transport::fill() {
+    int total = 0;
+    int n;
+    while((n = readIntoBuffer(m_rxBuffer.available())) > 0) {
+        total += n;
+    }
+    return total;
+}
+int Transport::receive(int expected, long timeOut_ms) {
+    long long start = monotonicMicroseconds();
+    long long deadline = start + (long long)timeOut_ms * 1000;
+    if(expected > (int)m_rxBuffer.capacity()) {
+        expected = (int)m_rxBuffer.capacity();
+    }
+    fill();
+    while((int)m_rxBuffer.size() < expected) {
+        long long remaining = deadline - monotonicMicroseconds();
+        if(isCancelled() || remaining <= 0 || !waitReadable((long)((remaining + 999) / 1000))) {
+            break;
+        }
+        if(fill() == 0 && !isOpen()) {
+            break;
+        }
+    }
+    m_lastReadLatency = (long)(monotonicMicroseconds() - start);
+    return (int)m_rxBuffer.size();
+}
+int Transport::readBlocking(unsigned char *buf, int expected, long timeOut_ms) {
+    receive(expected, timeOut_ms);
+    int got = (int)m_rxBuffer.copyOut(buf, expected);
+    m_rxBuffer.consume(got);
+    return got;
+}
+bool Transport::waitQuiet(long idle_us, long timeOut_ms) {
+    long long lastByte = monotonicMicroseconds();
+    long long deadline = lastByte + (long long)timeOut_ms * 1000;
+    discardExisting();
+    for(;;) {
+        long long now = monotonicMicroseconds();
+        long long quietAt = lastByte + idle_us;
+        if(now >= quietAt) {
+            return true;
+        }
+        if(now >= deadline || isCancelled() || !isOpen()) {
+            return false;
+        }
+        long long until = quietAt < deadline ? quietAt : deadline;
+        if(waitReadable((long)((until - now + 999) / 1000))) {
+            //Anything at all starts the wait over
+            if(fill() > 0) {
+                lastByte = m_lastReadTime;
+                m_rxBuffer.clear();
+            }
+        }
+    }
+}
+void Transport::drainOutput() {
+}
+long Transport::getOverruns() {
+    return -1;
+}
+long Transport::getLastReadLatency() const {
+    return m_lastReadLatency;
+}
+long long Transport::getLastReadTime() const {
+    return m_lastReadTime;
+}
+void Transport::setCapture(CaptureLog *capture) {
+    m_capture = capture;
+}
+CaptureLog *Transport::getCapture() const {
+    return m_capture;
+}
+int Transport::fileDescriptor() const {
+    return -1;
+}
+void Transport::cancel() {
+    setCancelled(true);
+#ifndef WIN32
+    if(m_cancelPipe[1] != -1) {
+        unsigned char wake = 1;
+        if(write(m_cancelPipe[1], &wake, 1) < 0) {
+            //Full, so a wake up is already waiting
+        }
+    }
+#endif
+}
+void Transport::clearCancel() {
+    setCancelled(false);
+#ifndef WIN32
+    if(m_cancelPipe[0] != -1) {
+        unsigned char wake[16];
+        while(read(m_cancelPipe[0], wake, sizeof(wake)) > 0) {
+        }
+    }
+#endif
+}
+bool Transport::isCancelled() const {
+#ifdef __GNUC__
+    return __atomic_load_n(&m_cancelled, __ATOMIC_ACQUIRE);
+#else
+    //volatile already reads with acquire on MSVC
+    return m_cancelled;
+#endif
+}
+void Transport::setCancelled(bool cancelled) {
+#ifdef __GNUC__
+    __atomic_store_n(&m_cancelled, cancelled, __ATOMIC_RELEASE);
+#else
+    m_cancelled = cancelled;
+#endif
+}
+#ifndef WIN32
+short Transport::pollPort(int fd, long timeOut_ms) {
+    struct pollfd pfd[2];
+    pfd[0].fd = fd;
+    pfd[0].events = POLLIN;
+    pfd[0].revents = 0;
+    pfd[1].fd = m_cancelPipe[0];
+    pfd[1].events = POLLIN;
+    pfd[1].revents = 0;
+    int r;
+    do {
+        if(isCancelled()) {
+            return 0;
+        }
+        r = poll(pfd, 2, (int)timeOut_ms);
+    } while(r < 0 && errno == EINTR);
+    if(r <= 0 || isCancelled()) {
+        return 0;
+    }
+    return pfd[0].revents;
+}
+#endif
@@ -0,0 +1,211 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#include <string>
+#include "RingBuffer.h"
+
+namespace KClmtrBase {
+namespace KClmtrNative {
+class CaptureLog;
+/**
+ * @brief Something that bytes to and from a Klein device go through, like a serial port
+ * @details A backend only has to move bytes, the receive buffer and waiting for replies are done here.
+ * @see SerialPort
+ * @see MemoryTransport
+ * @see PtyTransport
+ * @see FileReplayTransport
+ */
+class Transport {
+public:
+    Transport();
+    virtual ~Transport();
+    /**
+     * @brief Open the port after portName is set
+     */
+    virtual bool openPort() = 0;
+    /**
+     * @brief Closes the port
+     */
+    virtual bool closePort() = 0;
+    /**
+     * @brief To see if the port is open or not
+     * return Is the port Open? true = yes
+     */
+    virtual bool isOpen() = 0;
+    /**
+     * @brief Settings need to be set after opening the portName
+     * @param speed 	The baud rate of the device
+     * @param wordSize 	The size of a char
+     * @param parity
+     * @param timeOut	The amount of time it needs to wait in windows before stoping.
+     *					Ignored everywhere else, and by every other Transport, each read has its own time out
+     * @return false if the port did not take the settings
+     */
+    virtual bool setSetting(int speed, int wordSize, char parity, int timeOut) = 0;
+    /**
+     * @brief Write to the port
+     * @param buf The string to write
+     * @param bufSize the max size of buf
+     * @return The size of string that was written
+     */
+    int writePort(const unsigned char *buf, size_t bufSize);
+    /**
+     * @brief The baud rate from the last setSetting() that worked
+     */
+    int getSpeed() const;
+
+    /**
+     * @brief To find all the bites in the buffer and return it in a string
+     * @return String in the buffer
+     */
+    const std::string readExisting();
+    /**
+     * @brief Throws away everything that is waiting, without making a string
+     */
+    void discardExisting();
+    /**
+     * @brief Moves whatever is waiting in the port into receiveBuffer(), without blocking
+     * @return the number of bytes added
+     */
+    int fill();
+    /**
+     * @brief Blocks until receiveBuffer() holds expected bytes or the time out has passed
+     * @param expected The number of bytes to wait for
+     * @param timeOut_ms The max amount of time to wait in milliseconds
+     * @return The number of bytes in receiveBuffer()
+     */
+    virtual int receive(int expected, long timeOut_ms);
+    /**
+     * @brief The bytes that have been read from the port but not used yet
+     */
+    RingBuffer &receiveBuffer();
+    /**
+     * @brief Blocking read that wakes as soon as expected bytes have arrived or the time out has passed
+     * @param buf The buffer to store it in, must hold expected bytes
+     * @param expected The number of bytes to wait for
+     * @param timeOut_ms The max amount of time to wait in milliseconds
+     * @return The number of bytes stored in buf
+     */
+    int readBlocking(unsigned char *buf, int expected, long timeOut_ms);
+    /**
+     * @brief Throws away whatever comes in until nothing has come for idle_us, like the end of a stream
+     * @param idle_us How long the port has to stay quiet
+     * @param timeOut_ms The max amount of time to wait in milliseconds
+     * @return true if it went quiet, false if the time ran out, the port is gone or it was cancelled
+     */
+    bool waitQuiet(long idle_us, long timeOut_ms);
+    /**
+     * @brief Blocks until everything written has gone out of the port, so the speed can be changed
+     */
+    virtual void drainOutput();
+    /**
+     * @brief Times the driver or the UART lost bytes because they were not read in time, since the port was opened
+     * @return -1 if the port can't tell
+     */
+    virtual long getOverruns();
+    /**
+     * @brief The time the last receive() spent waiting for its bytes
+     * @return latency in microseconds
+     */
+    long getLastReadLatency() const;
+    /**
+     * @brief When the last bytes came out of the port
+     * @return microseconds from monotonicMicroseconds(), 0 if nothing has been read
+     */
+    long long getLastReadTime() const;
+    /**
+     * @brief Saves every byte read and written from now on, NULL to stop
+     * @param capture Has to stay around until it is taken off
+     */
+    void setCapture(CaptureLog *capture);
+    CaptureLog *getCapture() const;
+    /**
+     * @brief The descriptor a poll or epoll can wait on, for waiting on many ports at once
+     * @return -1 if the port does not have one
+     */
+    virtual int fileDescriptor() const;
+    /**
+     * @brief Wakes up anything waiting on the port from another thread, like a stream being stopped.
+     * Every wait returns right away until clearCancel()
+     */
+    void cancel();
+    void clearCancel();
+    bool isCancelled() const;
+
+    /**
+     * @brief To read and set the port location
+     */
+    std::string portName;
+protected:
+    /**
+     * @brief Reads what has already come in, without waiting
+     * @param buf Where to put it
+     * @param max The most it can take
+     * @return The number of bytes read, 0 if there was nothing, -1 on an error
+     */
+    virtual int readSome(unsigned char *buf, size_t max) = 0;
+    /**
+     * @brief Sleeps until there is something for readSome()
+     * @param timeOut_ms The max amount of time to wait in milliseconds
+     * @return false if the time ran out or the port is gone
+     */
+    virtual bool waitReadable(long timeOut_ms) = 0;
+    /**
+     * @brief Writes to the port, for writePort()
+     * @return The number of bytes written, -1 on an error
+     */
+    virtual int writeSome(const unsigned char *buf, size_t bufSize) = 0;
+    /**
+     * @brief readSome() straight into receiveBuffer()
+     * @return what readSome() returned
+     */
+    int readIntoBuffer(size_t max);
+#ifndef WIN32
+    /**
+     * @brief poll() on the port that also wakes up on cancel(), for waitReadable() and receive()
+     * @param fd The port
+     * @param timeOut_ms The max amount of time to wait in milliseconds
+     * @return The port's revents, 0 if the time ran out, it failed or it was cancelled
+     */
+    short pollPort(int fd, long timeOut_ms);
+#endif
+
+    RingBuffer m_rxBuffer;
+    long m_lastReadLatency;
+    long long m_lastReadTime;
+    CaptureLog *m_capture;
+    int m_speed;
+private:
+    //Set from another thread, only used through isCancelled() and setCancelled()
+    volatile bool m_cancelled;
+    void setCancelled(bool cancelled);
+#ifndef WIN32
+    //Written by cancel(), so a poll() wakes up
+    int m_cancelPipe[2];
+#endif
+    Transport(const Transport &);
+    Transport &operator=(const Transport &);
+};
+}
+}
@@ -0,0 +1,97 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+//Runs the K-10 emulator on a pty until it is stopped with Ctrl-C
+//Prints the port to connect KClmtr to
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <unistd.h>
+#include "../KClmtrEmulator.h"
+
+using namespace KClmtrBase::KClmtrNative;
+
+static KClmtrEmulator *emulator = NULL;
+
+static void stopEmulator(int) {
+    if(emulator != NULL) {
+        emulator->stop();
+    }
+}
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [options]\n"
+            "  --fast                 No waiting, everything as fast as possible\n"
+            "  --baud <speed>         Wire speed of the replies, 0 for none (9600)\n"
+            "  --delay <us>           Time before each reply starts (2000)\n"
+            "  --model <model>        Model (K-10-A)\n"
+            "  --sn <serial>          Serial number (EMU000001)\n"
+            "  --firmware <version>   Firmware, 01.09fh or older has the slow flicker (01.10fh)\n"
+            "  --xyz <X> <Y> <Z>      What it measures (95.047 100 108.883)\n"
+            "  --flicker <Hz> <%%>     Ripple on the light (30 10)\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    KClmtrEmulator k10;
+    std::string model = "K-10-A";
+    std::string serialNumber = "EMU000001";
+    for(int i = 1; i < argc; ++i) {
+        int left = argc - i - 1;
+        if(strcmp(argv[i], "--fast") == 0) {
+            k10.setFastAsPossible();
+        } else if(strcmp(argv[i], "--baud") == 0 && left >= 1) {
+            k10.setBaudRate(atoi(argv[++i]));
+        } else if(strcmp(argv[i], "--delay") == 0 && left >= 1) {
+            k10.setCommandDelay(atol(argv[++i]));
+        } else if(strcmp(argv[i], "--model") == 0 && left >= 1) {
+            model = argv[++i];
+        } else if(strcmp(argv[i], "--sn") == 0 && left >= 1) {
+            serialNumber = argv[++i];
+        } else if(strcmp(argv[i], "--firmware") == 0 && left >= 1) {
+            k10.setFirmware(argv[++i]);
+        } else if(strcmp(argv[i], "--xyz") == 0 && left >= 3) {
+            k10.setXYZ(atof(argv[i + 1]), atof(argv[i + 2]), atof(argv[i + 3]));
+            i += 3;
+        } else if(strcmp(argv[i], "--flicker") == 0 && left >= 2) {
+            k10.setFlicker(atof(argv[i + 1]), atof(argv[i + 2]));
+            i += 2;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    k10.setModel(model, serialNumber);
+    if(!k10.open()) {
+        fprintf(stderr, "Could not open a pty\n");
+        return 1;
+    }
+    printf("%s\n", k10.slaveName().c_str());
+    fflush(stdout);
+
+    emulator = &k10;
+    signal(SIGINT, stopEmulator);
+    signal(SIGTERM, stopEmulator);
+    k10.run();
+    printf("%llu commands, %llu flicker frames\n", k10.getCommandCount(), k10.getFrameCount());
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*
+KClmtr Object to communicate with Klein K-10/8/1
+
+Copyright (c) 2017 Klein Instruments Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+//Times the N5 round trip to a device with and without the low latency mode
+#include <cstdio>
+#include <cstdlib>
+#include "../KClmtr.h"
+
+using namespace KClmtrBase;
+using namespace KClmtrBase::KClmtrNative;
+
+static bool timeRoundTrip(const char *portName, bool lowLatency, int count) {
+    KClmtr k;
+    k.setLowLatency(lowLatency);
+    if(!k.connect(portName)) {
+        fprintf(stderr, "Could not connect to %s\n", portName);
+        return false;
+    }
+    SerialPort *port = dynamic_cast<SerialPort *>(k.getTransport());
+    int timer = port != NULL ? port->getLatencyTimer() : -1;
+    for(int i = 0; i < count; ++i) {
+        Measurement m = k.getNextMeasurement(1);
+        if(m.getErrorCode() & (KleinsErrorCodes::NOT_OPEN | KleinsErrorCodes::TIMED_OUT | KleinsErrorCodes::LOST_CONNECTION)) {
+            fprintf(stderr, "Measurement failed: %u\n", m.getErrorCode());
+            return false;
+        }
+    }
+    printf("%-12s latency timer %3d ms   N5 round trip %8.2f ms\n",
+           lowLatency ? "low latency" : "default", timer, k.getRoundTrip("N5") / 1000.0);
+    k.closePort();
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if(argc < 2) {
+        fprintf(stderr, "Usage: %s <port> [measurements]\n", argv[0]);
+        return 1;
+    }
+    int count = argc > 2 ? atoi(argv[2]) : 20;
+    if(!timeRoundTrip(argv[1], false, count) || !timeRoundTrip(argv[1], true, count)) {
+        return 1;
+    }
+    return 0;
+}